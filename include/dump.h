@@ -0,0 +1,160 @@
+/*
+
+    Reading of dump files, shared by driver and layouts.
+
+    A dump is either an ELF core file or parsed memory.
+    Of an ELF file, the part from the first page-aligned program section to the section headers is measured.
+    Parsed memory is measured as a whole.
+    This always assumes 4096byte page size for real-word dump files.
+    Loaded segments of an ELF file map virtual addresses to pages of the measured part.
+
+    HEAP Lab, Virginia Tech
+    Oct 2019
+*/
+
+#ifndef DUMP_H
+#define DUMP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+//Finds measured part of dump, from start to end in bytes. Returns 0 on error
+static inline int dump_range(char * fn, uint64_t * start, uint64_t * end)
+{
+    Elf64_Ehdr header;
+    FILE * ef = fopen(fn, "rb");
+    if (!ef)
+        return 0;
+    if (fread(&header, 1, sizeof(header), ef) <= 0)
+    {
+        fclose(ef);
+        return 0;
+    }
+    *start = 0;
+    if (!!memcmp(header.e_ident, ELFMAG, SELFMAG))
+        //assume parsed
+        *end = -1;
+    else
+    {
+        *end = header.e_shoff; // end of program section. start of next section
+        *start = 0;
+        fseek(ef, header.e_phoff, SEEK_SET);
+        int i;
+        for (i = 0; i < header.e_phnum; i++) // Find the first aligned program section
+        {
+            Elf64_Phdr pHdr;
+            if (fread(&pHdr, 1, sizeof(Elf64_Phdr), ef) <= 0)
+            {
+                fclose(ef);
+                return 0;
+            }
+            if (pHdr.p_memsz != 0 && (pHdr.p_memsz & (0xfff)) == 0)
+            {
+                *start = pHdr.p_offset;
+                break;
+            }
+        }
+    }
+    fseek(ef, 0L, SEEK_END);
+    uint64_t cap = ftell(ef);
+    if (cap < *end)
+        //for elf file that failed half way generating
+        *end = cap;
+    fclose(ef);
+    *end = *start + ((*end - *start) & ~0xfff);
+    return 1;
+}
+
+//Maps measured part of dump read only and sets its length in pages. Returns NULL on error
+static inline uint8_t * dump_map(char * fn, uint64_t * pages)
+{
+    uint64_t start, end;
+    if (!dump_range(fn, &start, &end) || end <= start)
+        return NULL;
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    uint8_t * m = mmap(0, end, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED)
+        return NULL;
+    *pages = (end - start) / PAGE_SIZE;
+    return m + start;
+}
+
+//loaded segment of ELF dump in measured part
+struct dump_segment
+{
+    uint64_t vaddr;     //virtual address of segment
+    uint64_t size;      //bytes of segment in dump
+    uint64_t page;      //index of first page of segment in measured part
+};
+
+static int dump_segment_cmp(const void * a, const void * b)
+{
+    uint64_t x = ((struct dump_segment *)a)->vaddr, y = ((struct dump_segment *)b)->vaddr;
+    return x < y ? -1 : x > y;
+}
+
+//Reads loaded segments of ELF dump that are in measured part to *seg, sorted by vaddr. Free *seg after use
+//Returns count of segments, 0 if dump is not ELF or has none
+static inline int dump_segments(char * fn, struct dump_segment ** seg)
+{
+    Elf64_Ehdr header;
+    uint64_t start, end;
+    int i, count = 0;
+    *seg = NULL;
+    if (!dump_range(fn, &start, &end))
+        return 0;
+    FILE * ef = fopen(fn, "rb");
+    if (!ef)
+        return 0;
+    if (fread(&header, 1, sizeof(header), ef) <= 0 || !!memcmp(header.e_ident, ELFMAG, SELFMAG))
+    {
+        fclose(ef);
+        return 0;
+    }
+    *seg = malloc(sizeof(struct dump_segment) * (header.e_phnum + 1));
+    fseek(ef, header.e_phoff, SEEK_SET);
+    for (i = 0; i < header.e_phnum; i++)
+    {
+        Elf64_Phdr pHdr;
+        if (fread(&pHdr, 1, sizeof(Elf64_Phdr), ef) <= 0)
+            break;
+        if (pHdr.p_type != PT_LOAD || pHdr.p_filesz == 0 || pHdr.p_offset < start || pHdr.p_offset >= end
+            || ((pHdr.p_offset - start) & 0xfff))
+            continue;
+        (*seg)[count].vaddr = pHdr.p_vaddr;
+        (*seg)[count].size = pHdr.p_offset + pHdr.p_filesz > end ? end - pHdr.p_offset : pHdr.p_filesz;
+        (*seg)[count++].page = (pHdr.p_offset - start) / PAGE_SIZE;
+    }
+    fclose(ef);
+    qsort(*seg, count, sizeof(struct dump_segment), dump_segment_cmp);
+    return count;
+}
+
+//Returns index of page holding vaddr in measured part, or -1 if vaddr is not in dump
+static inline int64_t dump_page(struct dump_segment * seg, int count, uint64_t vaddr)
+{
+    int lo = 0, hi = count;
+    //last segment starting at or below vaddr
+    while (hi - lo > 1)
+    {
+        int mid = (lo + hi) / 2;
+        if (seg[mid].vaddr <= vaddr)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    if (count == 0 || vaddr < seg[lo].vaddr || vaddr - seg[lo].vaddr >= seg[lo].size)
+        return -1;
+    return seg[lo].page + (vaddr - seg[lo].vaddr) / PAGE_SIZE;
+}
+
+#endif
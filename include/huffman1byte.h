@@ -5,9 +5,14 @@
     This implementation focuses on speed.
 
     This implementation only consider bytes and uses canonical Huffman code
-    Compressed data stores depth-element count and a dictionary. 
+    Compressed data stores depth-element count and a dictionary.
     A escape character and a plain text is used for elements that has occurence lower than a limit.
 
+    Byte counts use 4 histogram banks so repeated bytes do not serialize on one counter.
+    Code lengths come from an in-place two-queue Huffman builder (Moffat-Katajainen),
+    and are limited to 15 with package-merge when needed.
+    Compressed size is computed from lengths and counts, data is only written on request.
+
     By Yuqing Liu
     HEAP Lab, Virginia Tech 
     Apr 2019
@@ -15,507 +20,426 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <BitStream64.h>
+#include <package_merge.h>
 
-#define Huff_if_tree(a) (a >= 257)
-#define Huff_tree2index(a) (a >= 257 ? a - 257 : a)
-#define Huff_make_tree(a) (a + 257)
 #define LOW_OCC_LIMIT(a) (9) //((int)(8.0/4096*a)), magic number got by trial&error, may fail depend on usage
+#define HUFF_MAX_DEPTH (15)  //depth is stored in 4 bits
+#define HUFF_SYMBOLS (257)   //256 bytes and escape character
+#define HUFF_ESCAPE (256)
+#define HUFF_LUT_BITS (10)   //codewords up to this length are decoded with one table lookup
+#define HUFF_LUT_ESCAPE (0xffff)
 
-struct linked_node      //For element occurence and tree depth. May be repurposed
+struct huff_lut_entry
 {
-    int16_t info;       //Count, depth, element, etc
-    int16_t next;       //offset of next node in array, -1 for end
+    uint16_t value;     //offset into dictionary, or HUFF_LUT_ESCAPE
+    uint8_t depth;      //0 if codeword is longer than HUFF_LUT_BITS
 };
 
-struct linked_tree_node //Similar to linked node. added tree offsets. May be repurposed
+//code of a compressed page read by Huffman1_decode_init, to decode the page more than once
+struct huff_decoder
 {
-    int16_t info;
-    int16_t next;
-    int16_t left;
-    int16_t right;
+    int16_t depth, escape;
+    int16_t count[HUFF_MAX_DEPTH + 1];
+    uint16_t first[HUFF_MAX_DEPTH + 1];
+    int16_t offset[HUFF_MAX_DEPTH + 1];
+    int cur;            //offset of codewords, after dictionary
+    struct huff_lut_entry lut[1 << HUFF_LUT_BITS];
 };
 
 /*
- * Sort a linked list of byte_node. next = -1 is end. 
- * *List must be constructed before use
- * takes parameter of memory block of byte_node, and current head of list
- * returns head of list and tail of list in parameter
+ * Sort symbols by ascending count. Two passes of byte radix sort, counts must be less than 65536.
+ * sym is the input list of symbols, sorted result is written to sym and weight
  */
-static int16_t Huffman1_quick_sort(struct linked_node * list, int16_t head, int16_t * tail)
-{
-    int16_t heads[2], tails[2], i;
-    heads[0] = heads[1] = tails[0] = tails[1] = -1;
-    *tail = head;
-    //construct the two lists
-    for (i = list[head].next; i != -1; i = list[i].next)
-    {
-        int temp = 1;
-        if (list[i].info < list[head].info)
-            temp = 0;
-        if (heads[temp] == -1)
-            heads[temp] = i;
-        else
-            list[tails[temp]].next = i;
-        tails[temp] = i;
-    }
-    //sort and attach lists together
-    list[head].next = -1;
-    if (tails[0] != -1)
-    {
-        list[tails[0]].next = -1;
-        heads[0] = Huffman1_quick_sort(list, heads[0], &(tails[0]));
-        list[tails[0]].next = head;
-        head = heads[0];
-    }
-    if (tails[1] != -1)
-    {
-        list[tails[1]].next = -1;
-        heads[1] = Huffman1_quick_sort(list, heads[1], &(tails[1]));
-        list[*tail].next = heads[1];
-        *tail = tails[1];
-    }
-    return head;
-}
-
-//write depth to tree nodes, recursivly
-static void Huff_tree_level(struct linked_tree_node* tree, struct linked_node* nodes, int16_t root, int16_t level)
+static void Huffman1_sort(uint16_t * sym, uint32_t * weight, int n, uint32_t * count)
 {
-    if (Huff_if_tree(root))
+    uint16_t temp[HUFF_SYMBOLS];
+    int bucket[256];
+    int pass, i;
+    for (pass = 0; pass < 16; pass += 8)
     {
-        root = Huff_tree2index(root);
-        Huff_tree_level(tree, nodes, tree[root].left, level + 1);
-        Huff_tree_level(tree, nodes, tree[root].right, level + 1);
+        uint16_t * from = pass ? temp : sym;
+        uint16_t * to = pass ? sym : temp;
+        memset(bucket, 0, sizeof(bucket));
+        for (i = 0; i < n; i++)
+            bucket[(count[from[i]] >> pass) & 0xff]++;
+        int sum = 0;
+        for (i = 0; i < 256; i++)
+        {
+            int t = bucket[i];
+            bucket[i] = sum;
+            sum += t;
+        }
+        for (i = 0; i < n; i++)
+            to[bucket[(count[from[i]] >> pass) & 0xff]++] = from[i];
     }
-    else
-        nodes[root].info = level;
+    for (i = 0; i < n; i++)
+        weight[i] = count[sym[i]];
 }
 
-//Normalizes a linked list of leaf nodes to depth <= 15, recursivly
-//list should be sorted from deeper to shallower, or, by less to more occurrences
-//valid depth should be already writen in count field
-//uses table to speed up process. idealy O(n) for entire tree. 
-static int16_t Huff_normalize_tree(struct linked_node* nodes, int16_t head, int16_t count)
+/*
+ * In-place minimum redundancy code lengths (Moffat and Katajainen, 1995).
+ * a holds ascending weights of n >= 2 symbols, and is replaced by code lengths
+ * Longest code is returned in a[0]
+ */
+static void Huffman1_code_length(uint32_t * a, int n)
 {
-    static int16_t numList[16] = {0x7fff, 0x3fff, 0x1fff, 0xfff, 0x7ff, 0x3ff, 0x1ff, 0xff, 0x7f, 0x3f, 0x1f, 0xf, 0x7, 0x3, 0x1, 0x0};
-    static uint8_t numTable1[127] = {   0x0, 
-                                        0x1,    0x1,    0x3,    0x3,    0x3,    0x3,    0x7,    0x7, 
-                                        0x7,    0x7,    0x7,    0x7,    0x7,    0x7,    0xf,    0xf,
-                                        0xf,    0xf,    0xf,    0xf,    0xf,    0xf,    0xf,    0xf,
-                                        0xf,    0xf,    0xf,    0xf,    0xf,    0xf,    0x1f,   0x1f,
-                                        0x1f,   0x1f,   0x1f,   0x1f,   0x1f,   0x1f,   0x1f,   0x1f,
-                                        0x1f,   0x1f,   0x1f,   0x1f,   0x1f,   0x1f,   0x1f,   0x1f,
-                                        0x1f,   0x1f,   0x1f,   0x1f,   0x1f,   0x1f,   0x1f,   0x1f,
-                                        0x1f,   0x1f,   0x1f,   0x1f,   0x1f,   0x1f,   0x3f,   0x3f,
-                                        0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,
-                                        0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,
-                                        0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,
-                                        0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,
-                                        0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,
-                                        0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,
-                                        0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f,
-                                        0x3f,   0x3f,   0x3f,   0x3f,   0x3f,   0x3f};
-    static uint8_t numTable2[127] = {   15,
-                                        14, 14, 13, 13, 13, 13, 12, 12,
-                                        12, 12, 12, 12, 12, 12, 11, 11,
-                                        11, 11, 11, 11, 11, 11, 11, 11,
-                                        11, 11, 11, 11, 11, 11, 10, 10,
-                                        10, 10, 10, 10, 10, 10, 10, 10,
-                                        10, 10, 10, 10, 10, 10, 10, 10,
-                                        10, 10, 10, 10, 10, 10, 10, 10,
-                                        10, 10, 10, 10, 10, 10, 9,  9,
-                                        9,  9,  9,  9,  9,  9,  9,  9,
-                                        9,  9,  9,  9,  9,  9,  9,  9,
-                                        9,  9,  9,  9,  9,  9,  9,  9,
-                                        9,  9,  9,  9,  9,  9,  9,  9,
-                                        9,  9,  9,  9,  9,  9,  9,  9,
-                                        9,  9,  9,  9,  9,  9,  9,  9,
-                                        9,  9,  9,  9,  9,  9,  9,  9,
-                                        9,  9,  9,  9,  9,  9};
-    int16_t lev = 0;
-    if (nodes[head].info > 15) //normalize larger depth to 15
+    int root, leaf, next, avbl, used, dpth;
+    a[0] += a[1];
+    root = 0;
+    leaf = 2;
+    for (next = 1; next < n - 1; next++)
     {
-        count = count + 1;
-        nodes[head].info = 15;
-    }
-    else if (count == 0)
-        return 0;
-    else    //if need more space in the depth 15 row
-    {
-        count = count - numList[nodes[head].info]; //reduce space needed
-        nodes[head].info = 15;
-    }
-    if (count > 0)  //need more space from next node
-        lev = Huff_normalize_tree(nodes, nodes[head].next, count);
-    else    //got enough or extra 
-        lev = -count;
-    if (lev > 0) //reduce depth to ultilizes left over spaces.
-    {
-        if (lev < 127)
-        {
-            nodes[head].info = numTable2[lev];
-            lev -= numTable1[lev];
-        }
-        else if (lev < 255)
-        {
-            nodes[head].info = 8;
-            lev -= 127;
-        }
-        else if (lev < 511)
+        //first child
+        if (leaf >= n || a[root] < a[leaf])
         {
-            nodes[head].info = 7;
-            lev -= 255;
+            a[next] = a[root];
+            a[root++] = next;
         }
-        else if (lev < 1023)
+        else
+            a[next] = a[leaf++];
+        //second child
+        if (leaf >= n || (root < next && a[root] < a[leaf]))
         {
-            nodes[head].info = 6;
-            lev -= 512;
+            a[next] += a[root];
+            a[root++] = next;
         }
-        else if (lev < 2047)
+        else
+            a[next] += a[leaf++];
+    }
+    //parent pointers to internal node depth
+    a[n - 2] = 0;
+    for (next = n - 3; next >= 0; next--)
+        a[next] = a[a[next]] + 1;
+    //internal node depth to leaf depth
+    avbl = 1;
+    used = dpth = 0;
+    root = n - 2;
+    next = n - 1;
+    while (avbl > 0)
+    {
+        while (root >= 0 && a[root] == dpth)
         {
-            nodes[head].info = 5;
-            lev -= 1023;
+            used++;
+            root--;
         }
-        else
+        while (avbl > used)
         {
-            nodes[head].info = 4;
-            lev -= 2047;
+            a[next--] = dpth;
+            avbl--;
         }
+        avbl = 2 * used;
+        dpth++;
+        used = 0;
     }
-    return lev;
 }
 
 //Dest should be at least size + 12 + 256 bytes long to hold all data.
+//dest can be NULL if only the size is needed. size must be less than 65536
+//histogram is byte occurrence of data if already known, or NULL
 //Returns compressed size in bytes
-static uint64_t Huffman1_encode(uint8_t * data, uint8_t * dest, int size)
+static uint64_t Huffman1_encode(uint8_t * data, uint8_t * dest, int size, uint32_t * histogram)
 {
-    //initialize data
-    struct linked_node literals[257];
-    int i, cur;
-    for (i = 0; i < 257; i++)
-        literals[i].info = 0;
-    
-    //find occurance of bytes
-    for (i = 0; i < size; i++)
-        literals[data[i]].info++;
-
-    //create list for sort and ignore byte that didn't appear
-    //find first non-zero 
-    for (cur = 0; cur < 257; cur++)
-        if (literals[cur].info >= LOW_OCC_LIMIT(size))
-            break;
-        else
+    uint32_t bank[4][256];
+    uint32_t count[HUFF_SYMBOLS];
+    int i;
+    if (histogram == NULL)
+    {
+        memset(bank, 0, sizeof(bank));
+        //find occurance of bytes, 4 banks so runs of same byte don't stall on one counter
+        for (i = 0; i + 4 <= size; i += 4)
         {
-            literals[256].info += literals[cur].info;
-            literals[cur].info = 0;
+            bank[0][data[i]]++;
+            bank[1][data[i + 1]]++;
+            bank[2][data[i + 2]]++;
+            bank[3][data[i + 3]]++;
         }
+        for (; i < size; i++)
+            bank[0][data[i]]++;
+        for (i = 0; i < 256; i++)
+            count[i] = bank[0][i] + bank[1][i] + bank[2][i] + bank[3][i];
+    }
+    else
+        memcpy(count, histogram, 256 * sizeof(uint32_t));
 
-    literals[cur].next = -1; //Use as list end
-    int16_t prev = cur;
-    int16_t head = cur;
-    //form a list
-    for (cur++; cur < 257; cur++)
+    //send bytes with low occurance to escape character
+    uint16_t sym[HUFF_SYMBOLS];
+    int n = 0;
+    count[HUFF_ESCAPE] = 0;
+    for (i = 0; i < 256; i++)
     {
-        if (literals[cur].info >= LOW_OCC_LIMIT(size) || (cur == 256 && literals[cur].info > 0))
-        {
-            literals[prev].next = cur;
-            prev = cur;
-        }
+        if (count[i] >= LOW_OCC_LIMIT(size))
+            sym[n++] = i;
         else
         {
-            literals[256].info += literals[cur].info;
-            literals[cur].info = 0;
+            count[HUFF_ESCAPE] += count[i];
+            count[i] = 0;
         }
     }
-    literals[prev].next = -1;
+    if (count[HUFF_ESCAPE] > 0)
+        sym[n++] = HUFF_ESCAPE;
 
-    //short-circuit logic for incomplete tree 
+    //short-circuit logic for incomplete tree
     //would be 1 node at depth 0 but not allowed by storage structure
-    if (literals[prev].info == size)
+    if (n == 1)
     {
-        if (prev != 256)
+        if (sym[0] != HUFF_ESCAPE)
         {
-            dest[0] = 0x00;
-            dest[1] = prev & 0xff;
+            if (dest != NULL)
+            {
+                dest[0] = 0x00;
+                dest[1] = sym[0] & 0xff;
+            }
             return 2;
         }
-        else
+        if (dest != NULL)
         {
             dest[0] = 0x01;
-            for (i = 0; i < size; i++)
-                dest[i + 1] = data[i];
-            return size + 1;
+            memcpy(dest + 1, data, size);
         }
+        return size + 1;
     }
     //No we have at least 2 elements in tree, depth 1 or more
 
-    //sort the list
-    head = Huffman1_quick_sort(literals, head, &prev);
-
-    //use tree nodes to generate huffman tree
-    struct linked_tree_node tree [256];
-    cur = head;
-    int16_t cur_tree = -1;
-    int16_t tree_index = 0;
-    //each time generate one new tree node until one node left
-    while (cur != -1 || tree[cur_tree].next != -1)
+    //code lengths of symbols in ascending count order
+    uint32_t weight[HUFF_SYMBOLS];
+    uint8_t sorted_len[HUFF_SYMBOLS];
+    Huffman1_sort(sym, weight, n, count);
+    uint32_t a[HUFF_SYMBOLS];
+    memcpy(a, weight, n * sizeof(uint32_t));
+    Huffman1_code_length(a, n);
+    if (a[0] > HUFF_MAX_DEPTH)
     {
-        tree[tree_index].info = 0;
-        int16_t offsprings[2];
-        for (i = 0; i < 2; i++)
-        {
-            //get node from tree
-            if ((cur_tree != -1) && (cur == -1 || tree[cur_tree].info < literals[cur].info))
-            {
-                tree[tree_index].info += tree[cur_tree].info;
-                offsprings[i] = Huff_make_tree(cur_tree);
-                cur_tree = tree[cur_tree].next;
-            }
-            //get node from literals
-            else
-            {
-                tree[tree_index].info += literals[cur].info;
-                offsprings[i] = cur;
-                cur = literals[cur].next;
-            }
-        }
-        tree[tree_index].left = offsprings[0];
-        tree[tree_index].right = offsprings[1];
-        if (cur_tree == -1)
-        {
-            cur_tree = tree_index;
-            tree[tree_index].next = -1;
-        }
-        else if (tree[tree_index - 1].next == -1)
-        {
-            tree[tree_index - 1].next = tree_index;
-            tree[tree_index].next = -1;
-        }
-        else    //impossible fall-back condition with old code
-        {
-            printf("?\n");
-            int16_t temp = -1;
-            for (   prev = cur_tree; 
-                    tree[prev].info <= tree[tree_index].info; 
-                    prev = tree[prev].next)
-                temp = prev;
-            if (temp == -1)
-            {
-                tree[tree_index].next = cur_tree;
-                cur_tree = tree_index;
-            }
-            else
-            {
-                prev = tree[temp].next;
-                tree[temp].next = tree_index;
-                tree[tree_index].next = prev;
-            }
-        }
-        tree_index++;
+        uint64_t wide[HUFF_SYMBOLS];
+        for (i = 0; i < n; i++)
+            wide[i] = weight[i];
+        package_merge(wide, n, HUFF_MAX_DEPTH, sorted_len);
     }
-    
-    //Convert occurrence to depth in tree
-    Huff_tree_level(tree, literals, Huff_make_tree(cur_tree), 0);
-    
-    //Now we can discard the tree and use a table instead.
-    //length of codeword is count
-    //But first, normalize to max length of 15
-    Huff_normalize_tree(literals, head, 0);
+    else
+        for (i = 0; i < n; i++)
+            sorted_len[i] = a[i];
 
-    //codeword generation
-    struct linked_node table[16];
-    for (i = 0; i < 16; i++)
+    uint8_t len[HUFF_SYMBOLS];
+    int16_t table[HUFF_MAX_DEPTH + 1];
+    memset(len, 0, sizeof(len));
+    memset(table, 0, sizeof(table));
+    uint64_t bits = count[HUFF_ESCAPE] * 8;   //plain text following escape codeword
+    for (i = 0; i < n; i++)
     {
-        table[i].info = 0;
-        table[i].next = -1;
-    }
-    prev = cur = literals[head].info; //record largest depth
-    for (i = 256; i >=0 ; i--)
-    {
-        if (!!literals[i].info && literals[i].info < cur)
-            cur = literals[i].info;
-        int16_t next = table[literals[i].info].next;
-        table[literals[i].info].next = i;
-        table[literals[i].info].info ++;
-        literals[i].next = next;
+        len[sym[i]] = sorted_len[i];
+        table[sorted_len[i]]++;
+        bits += (uint64_t)weight[i] * sorted_len[i];
     }
+    int max_depth = sorted_len[0];
+    int min_depth = sorted_len[n - 1];
 
-    //write dictionary
-    dest[0] = (literals[256].info & 0xf) | ((prev & 0xf) << 4); //record tree depth and escape char depth
-    
+    //size of header: depth byte, depth counts, dictionary
+    int cur;
+    if (max_depth == min_depth) //all literals in one level
+        cur = 2;
+    else
+        cur = max_depth > 6 ? max_depth - 2 : 4;
+    int header = cur;
+    uint64_t total = cur + n - (count[HUFF_ESCAPE] > 0) + (bits + 7) / 8;
+    if (dest == NULL)
+        return total;
 
-    if (prev == cur) //all literals in one level
-    {
+    //write dictionary
+    dest[0] = (len[HUFF_ESCAPE] & 0xf) | ((max_depth & 0xf) << 4); //record tree depth and escape char depth
+    if (max_depth == min_depth)
         dest[1] = 0x80;
-        cur = 2;
-    }
     else
     {
         //depth 1:1 2:2 3:3 4:4 5:5 6:6 in 3 bytes: 1:1:5 2:6 3:4
         //These three bytes will always be used.
-        dest[1] = ((table[1].info & 1) << 5) | (table[5].info & 0x1f);
-        dest[2] = ((table[2].info & 3) << 6) | (table[6].info & 0x3f);
-        dest[3] = ((table[3].info & 7) << 4) | (table[4].info & 0xf);
+        dest[1] = ((table[1] & 1) << 5) | (table[5] & 0x1f);
+        dest[2] = ((table[2] & 3) << 6) | (table[6] & 0x3f);
+        dest[3] = ((table[3] & 7) << 4) | (table[4] & 0xf);
         //write the following depth counts
-        for (cur = 4; cur <= prev - 3; cur++)
-            dest[cur] = 0xff & table[cur + 3].info;
+        for (cur = 4; cur <= max_depth - 3; cur++)
+            dest[cur] = 0xff & table[cur + 3];
     }
-    
-    //generate codeword for each entry and write plain text for dict
-    int16_t cur_depth, next, codeword = 0;
-    for (i = 1; i < 16; i++)
+
+    //canonical codeword: shallower first, then by byte value. escape is last of its depth
+    uint16_t first[HUFF_MAX_DEPTH + 1];
+    int16_t offset[HUFF_MAX_DEPTH + 1];
+    uint16_t codeword = 0;
+    int d;
+    cur = header;
+    for (d = 1; d <= HUFF_MAX_DEPTH; d++)
     {
-        //printf("%d,", table[i].info);
-        cur_depth = table[i].next;
-        while (cur_depth != -1)
+        first[d] = codeword;
+        offset[d] = cur;
+        codeword = (codeword + table[d]) << 1;
+        cur += table[d];
+        if (d == len[HUFF_ESCAPE])  //escape char is not in dict
+            cur--;
+    }
+    uint16_t code[HUFF_SYMBOLS];
+    for (i = 0; i < HUFF_SYMBOLS; i++)
+        if (len[i])
         {
-            next = literals[cur_depth].next;
-            literals[cur_depth].next = codeword;
-            codeword++;
-            if (cur_depth != 256)
-            {
-                dest[cur] = cur_depth & 0xff;
-                cur++;
-            }
-            cur_depth = next;
+            code[i] = first[len[i]]++;
+            if (i != HUFF_ESCAPE)
+                dest[offset[len[i]]++] = i & 0xff;
         }
-        codeword = codeword << 1;
-    }
-    
-    //printf("%x: new\n", cur);
+    cur = header + n - (count[HUFF_ESCAPE] > 0);
 
     //encode data to dest
     BitStream64_t out;
     BitStream64_write_init(&out, dest + cur);
     for (i = 0; i < size; i++)
     {
-        //printf("%x ", literals[data[i]].info);
-        if (!literals[data[i]].info)
+        if (!len[data[i]])
         {
-            BitStream64_write(&out, (uint16_t)literals[256].next, literals[256].info);          //write escape codeword
-            BitStream64_write(&out, data[i], 8);                                                //write literal
+            BitStream64_write(&out, code[HUFF_ESCAPE], len[HUFF_ESCAPE]);   //write escape codeword
+            BitStream64_write(&out, data[i], 8);                            //write literal
         }
         else
-            BitStream64_write(&out, (uint16_t)literals[data[i]].next, literals[data[i]].info);  //write huffman codeword
+            BitStream64_write(&out, code[data[i]], len[data[i]]);           //write huffman codeword
     }
     cur += BitStream64_write_finish(&out);
-    //printf("\n");
-    return cur; 
+    return cur;
 }
 
-//dest should be at least size bytes long to hold all data.
-//size is decode size
-//returns compressed size
-static uint64_t Huffman1_decode(uint8_t * data, uint8_t * dest, int size)
+//reads code of compressed data and builds lookup table for short codewords. Not needed for pages stored as one byte or raw
+static void Huffman1_decode_init(uint8_t * data, struct huff_decoder * dc)
 {
     int i, j, cur;
-    if (!data[0])
-    {
-        for (i = 0; i < size; i++)
-            dest[i] = data[1];
-        return 2;
-    }
-    if (data[0] == 1)
-    {
-        for (i = 0; i < size; i++)
-            dest[i] = data[i + 1];
-        return i + 1;
-    }
+    if (data[0] <= 1)
+        return;
 
     //retrive dict
-    int16_t depth = (data[0] >> 4) & 0xf;
-    int16_t escape = data[0] & 0xf;
+    int16_t depth = dc->depth = (data[0] >> 4) & 0xf;
+    int16_t escape = dc->escape = data[0] & 0xf;
 
-    //initialize table
-    struct linked_tree_node table[16];
-    for (i = 0; i < 16; i++)
-    {
-        table[i].info = 0;
-        table[i].next = -1;
-        table[i].left = -1;
-        table[i].right = -1;
-    }
+    //count, first codeword and dictionary offset of each depth
+    int16_t * count = dc->count;
+    uint16_t * first = dc->first;
+    int16_t * offset = dc->offset;
+    memset(count, 0, sizeof(dc->count));
     if (!(data[1] & 0x80))
     {
-        table[1].info = (data[1] >> 5) & 1;
-        table[5].info = data[1] & 0x1f;
-        table[2].info = (data[2] >> 6) & 3;
-        table[6].info = data[2] & 0x3f;
-        table[3].info = (data[3] >> 4) & 7;
-        table[4].info = data[3] & 0xf;
-        cur = 4;
+        count[1] = (data[1] >> 5) & 1;
+        count[5] = data[1] & 0x1f;
+        count[2] = (data[2] >> 6) & 3;
+        count[6] = data[2] & 0x3f;
+        count[3] = (data[3] >> 4) & 7;
+        count[4] = data[3] & 0xf;
         for (cur = 4; cur <= depth - 3; cur++)
-            table[cur + 3].info = data[cur];
+            count[cur + 3] = data[cur];
     }
     else // all on one depth
     {
-        table[depth].info = 1 << depth;
+        count[depth] = 1 << depth;
         cur = 2;
     }
-    
-    
-    //generate minimum codeword for each head of table
-    //generate lookup for faster decode
-    int16_t codeword = 0;
-    for (i = 1; i < 16; i++)
+
+    uint16_t codeword = 0;
+    for (i = 1; i <= HUFF_MAX_DEPTH; i++)
     {
-        //printf("%x\n", table[i].info);
-        if (table[i].info > 0)
+        first[i] = codeword;
+        offset[i] = cur;        //offset into dictionary
+        cur += count[i];
+        if (i == escape)        //reduce one for escape char, not in dict
+            cur--;
+        codeword = (codeword + count[i]) << 1;
+    }
+
+    dc->cur = cur;
+
+    //lookup table for short codewords
+    memset(dc->lut, 0, sizeof(dc->lut));
+    for (i = 1; i <= depth && i <= HUFF_LUT_BITS; i++)
+        for (j = 0; j < count[i]; j++)
         {
-            table[i].left = codeword;
-            codeword += table[i].info;
-            table[i].right = cur;       //offset into dictionary
-            if (i == escape)            //reduce one for escape char, not in dict
-                cur--;
-            cur += table[i].info;
+            struct huff_lut_entry e;
+            e.depth = i;
+            e.value = (i == escape && j == count[i] - 1) ? HUFF_LUT_ESCAPE : offset[i] + j;
+            int k, shift = HUFF_LUT_BITS - i;
+            for (k = (first[i] + j) << shift; k < (first[i] + j + 1) << shift; k++)
+                dc->lut[k] = e;
         }
-        codeword = codeword  << 1;
-    }
+}
 
-    //printf("%x\n", cur);
+//decodes size bytes of data with code read by Huffman1_decode_init from the same data. See Huffman1_decode
+static uint64_t Huffman1_decode_with(struct huff_decoder * dc, uint8_t * data, uint8_t * dest, int size)
+{
+    int i, d;
+    if (!data[0])
+    {
+        for (i = 0; i < size; i++)
+            dest[i] = data[1];
+        return 2;
+    }
+    if (data[0] == 1)
+    {
+        for (i = 0; i < size; i++)
+            dest[i] = data[i + 1];
+        return i + 1;
+    }
+    int16_t depth = dc->depth, escape = dc->escape;
+    int16_t * count = dc->count;
+    uint16_t * first = dc->first;
+    int16_t * offset = dc->offset;
+    uint16_t codeword;
+    int cur = dc->cur;
 
-    //mask for literal constrction
-    static uint8_t mask[] = {0, 1, 3, 7, 0xf, 0x1f, 0x3f, 0x7f, 0xff};
-    //recover original data
-    uint8_t payload = data[cur];
-    cur++;
-    uint8_t offset = 0;
+    //recover original data, codewords are read from top of a 64-bit buffer
+    uint8_t * in = data + cur;
+    uint64_t buf = 0;
+    int avail = 0;
+    uint64_t consumed = 0;
     for (i = 0; i < size; i++)
     {
-        codeword = 0;
-        for (j = 1; j < 16; j++)
+        while (avail <= 56)
         {
-            offset++;
-            if (offset == 9) //next byte
-            {
-                payload = data[cur];
-                cur++;
-                offset = 1;
-            }
-            codeword = (codeword << 1) | (uint16_t)(1 & ((uint16_t)payload >> (8 - offset)));   //construct codeword
-            if (codeword >= table[j].left && table[j].info > 0 && codeword < table[j].info + table[j].left)
+            buf |= (uint64_t)(*in++) << (56 - avail);
+            avail += 8;
+        }
+        struct huff_lut_entry e = dc->lut[buf >> (64 - HUFF_LUT_BITS)];
+        d = e.depth;
+        uint16_t value = e.value;
+        if (!d) //long codeword, search deeper levels
+            for (d = HUFF_LUT_BITS + 1; d <= depth; d++)
             {
-                //printf("%x ", j);
-                if (j == escape && codeword == table[j].info + table[j].left - 1) //matched escape char
+                codeword = buf >> (64 - d);
+                if (codeword >= first[d] && codeword < first[d] + count[d])
                 {
-                    if (offset == 8)
-                        dest[i] = data[cur];
-                    else
-                    {
-                        uint8_t temp = payload << offset;
-                        payload = data[cur];
-                        dest[i] = temp | ((payload >> (8 - offset)) & mask[offset]);
-                    }
-                    cur++;
+                    value = (d == escape && codeword == first[d] + count[d] - 1) ? HUFF_LUT_ESCAPE : offset[d] + codeword - first[d];
+                    break;
                 }
-                else
-                    dest[i] = data[codeword - table[j].left + table[j].right];
-                break;
             }
+        if (d > depth)
+        {
+            printf("huffman1 Error: invalid codeword at %d\n", i);
+            return 0;
+        }
+        buf <<= d;
+        avail -= d;
+        consumed += d;
+        if (value == HUFF_LUT_ESCAPE)   //matched escape char, plain text follows
+        {
+            dest[i] = buf >> 56;
+            buf <<= 8;
+            avail -= 8;
+            consumed += 8;
         }
+        else
+            dest[i] = data[value];
     }
-    //printf("\n");
-    return cur;
+    return cur + (consumed + 7) / 8;
 }
 
+//dest should be at least size bytes long to hold all data.
+//data is read up to 8 bytes beyond the compressed size.
+//size is decode size
+//returns compressed size
+static uint64_t Huffman1_decode(uint8_t * data, uint8_t * dest, int size)
+{
+    struct huff_decoder dc;
+    Huffman1_decode_init(data, &dc);
+    return Huffman1_decode_with(&dc, data, dest, size);
+}
@@ -0,0 +1,75 @@
+/*
+
+    Optimal length-limited Huffman code lengths by package-merge.
+    Based on: L. L. Larmore and D. S. Hirschberg, "A fast algorithm for optimal length-limited Huffman codes", JACM 1990
+
+    Shared by the byte Huffman coder and SC2.
+    Only the number of leaves in each level is tracked, since selected leaves are always a prefix.
+
+    HEAP Lab, Virginia Tech
+    Oct 2019
+*/
+
+#ifndef PACKAGE_MERGE_H
+#define PACKAGE_MERGE_H
+
+#include <stdint.h>
+
+/*
+ * weight holds ascending weights of n >= 2 symbols, lengths of the same order are written to len.
+ * Lengths are limited to depth bits, n must not exceed 2^depth.
+ */
+static void package_merge(uint64_t * weight, int n, int depth, uint8_t * len)
+{
+    uint64_t list[2][2 * n];
+    uint8_t leaf[depth][2 * n];
+    int size[depth];
+    int i, j, l;
+    //deepest level only has leaves
+    for (i = 0; i < n; i++)
+    {
+        list[0][i] = weight[i];
+        leaf[depth - 1][i] = 1;
+    }
+    size[depth - 1] = n;
+    //merge leaves with packages of the level below
+    for (l = depth - 2; l >= 0; l--)
+    {
+        uint64_t * prev = list[(depth - 2 - l) & 1];
+        uint64_t * cur = list[(depth - 1 - l) & 1];
+        int packages = size[l + 1] / 2;
+        int k = 0;
+        i = j = 0;
+        while (i < n || j < packages)
+        {
+            uint64_t p = j < packages ? prev[2 * j] + prev[2 * j + 1] : 0;
+            if (j >= packages || (i < n && weight[i] <= p))
+            {
+                cur[k] = weight[i++];
+                leaf[l][k++] = 1;
+            }
+            else
+            {
+                cur[k] = p;
+                leaf[l][k++] = 0;
+                j++;
+            }
+        }
+        size[l] = k;
+    }
+    //select first 2n-2 items of top level and follow packages down
+    for (i = 0; i < n; i++)
+        len[i] = 0;
+    int m = 2 * n - 2;
+    for (l = 0; l < depth && m > 0; l++)
+    {
+        int leaves = 0;
+        for (i = 0; i < m; i++)
+            leaves += leaf[l][i];
+        for (i = 0; i < leaves; i++)
+            len[i]++;
+        m = 2 * (m - leaves);
+    }
+}
+
+#endif
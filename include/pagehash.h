@@ -0,0 +1,67 @@
+/*
+
+    Fast 128-bit hash of a page for content lookups (deduplication, result caching).
+    Four independent 64-bit multiply-rotate lanes as in xxHash64, folded into two halves.
+    Not cryptographic. Both halves are never 0, so 0 can mark an empty slot.
+
+    HEAP Lab, Virginia Tech
+    Oct 2019
+*/
+
+#ifndef PAGEHASH_H
+#define PAGEHASH_H
+
+#include <stdint.h>
+
+#define PAGEHASH_P1 (0x9E3779B185EBCA87ull)
+#define PAGEHASH_P2 (0xC2B2AE3D27D4EB4Full)
+#define PAGEHASH_P3 (0x165667B19E3779F9ull)
+
+struct pagehash
+{
+    uint64_t lo;
+    uint64_t hi;
+};
+
+static inline uint64_t pagehash_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t pagehash_round(uint64_t acc, uint64_t w)
+{
+    return pagehash_rotl(acc + w * PAGEHASH_P2, 31) * PAGEHASH_P1;
+}
+
+static inline uint64_t pagehash_fmix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= PAGEHASH_P2;
+    h ^= h >> 29;
+    h *= PAGEHASH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+//size in bytes, multiple of 32
+static inline struct pagehash pagehash_compute(uint8_t * data, int size)
+{
+    uint64_t * w = (uint64_t *)data;
+    uint64_t a = PAGEHASH_P1 + PAGEHASH_P2, b = PAGEHASH_P2, c = 0, d = -PAGEHASH_P1;
+    int i;
+    for (i = 0; i < size / 8; i += 4)
+    {
+        a = pagehash_round(a, w[i]);
+        b = pagehash_round(b, w[i + 1]);
+        c = pagehash_round(c, w[i + 2]);
+        d = pagehash_round(d, w[i + 3]);
+    }
+    struct pagehash h;
+    h.lo = pagehash_fmix(pagehash_rotl(a, 1) + pagehash_rotl(b, 7) + pagehash_rotl(c, 12) + pagehash_rotl(d, 18) + size);
+    h.hi = pagehash_fmix((a ^ pagehash_rotl(c, 29)) * PAGEHASH_P3 + (b ^ pagehash_rotl(d, 37)) * PAGEHASH_P1 + h.lo);
+    h.lo += !h.lo;
+    h.hi += !h.hi;
+    return h;
+}
+
+#endif
@@ -16,6 +16,7 @@
 #include <stdbool.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifndef COMPRESSION_NODE_NAME
     #define COMPRESSION_NODE_NAME compression_node
@@ -30,7 +31,7 @@
     #define CACHELINE_SIZE (64)     //in bytes, keep it lower than 4096 bytes if reset
 #endif
 
-#define ZERO_SIZE (65535);          //Since 8*4096 = 32768, use larger number to represent the size of a page that is filled with 0
+#define ZERO_SIZE (65535)           //Since 8*4096 = 32768, use larger number to represent the size of a page that is filled with 0
 #define ZERO_CACHELINE(s) (~s);     //Use this for cacheline filled with zero. It should be greater than 32768
 #define ERROR_SIZE ((uint64_t)-1)   //If compression results in error, return this
 #define IS_ZERO_CACHELINE(s) (s>32768)
@@ -42,6 +43,9 @@
 #define layout_folder "bin/layout"
 #define layout_name "layout_node"
 
+//Body of a parallel loop over items begin to end of one chunk. chunk is 0 to threads - 1, use it to index per-chunk reductions
+typedef void (* parallel_chunk_t) (void * arg, uint64_t begin, uint64_t end, int chunk);
+
 //will be defined in driver.c. Add variable that is shared between compression, memory layout, and driver here.
 struct shared
 {
@@ -50,11 +54,84 @@ struct shared
     char * filename;
     int threads;        //Threads to use. For multithreaded memory layout calculations
     int header;         //flag to control whether a header of csv file (title of fields) needs to be printed.   default: on
+    double prefilter;   //entropy threshold in bits per byte. Pages above it are not compressed by opted-in compressions. 0 is off
+    int prefilter_verify;   //compress skipped pages anyway to count pages that would have compressed           default: off
+    int sample_stride;  //pre-pass gives 1 of this many pages to compressions that sample                       default: 16
+    uint64_t totalpages;    //pages in measured part of dump. Set before layouts and compressions initialize
+    int decompress_repeat;  //-D, times to decompress each page for timing. Keep compressed data of the last page per thread if set   default: 0
+    char ** config;         //-c key=value options for compressions and layouts, as given. Read them with shared_config
+    int config_count;
+    //Runs func over 0 to count in threads contiguous chunks on the driver's threads and waits for them. For L_final_r
+    void (* parallel_for) (uint64_t count, parallel_chunk_t func, void * arg);
+};
+
+//value of -c key=value option, or NULL if not given. Later options override earlier ones
+//name keys after the compression or layout, i.e. costmodel.burst
+static inline char * shared_config(struct shared * s, const char * key)
+{
+    int i;
+    size_t len = strlen(key);
+    for (i = s->config_count - 1; i >= 0; i--)
+        if (!strncmp(s->config[i], key, len) && s->config[i][len] == '=')
+            return s->config[i] + len + 1;
+    return NULL;
+}
+
+//parameter sets of -c key=set;set;... for layouts that report a column for each set, i.e. best-of.variants=bdi,lz4;cpack,lz4
+//Sets point into one copy of the option, free sets[0] when done. Returns count of sets, 0 if not given
+static inline int shared_variants(struct shared * s, const char * key, char ** sets, int max)
+{
+    char * v = shared_config(s, key);
+    int count = 0;
+    if (v == NULL || max <= 0)
+        return 0;
+    sets[count++] = v = strdup(v);
+    for (; *v != '\0' && count < max; v++)
+        if (*v == ';')
+        {
+            *v = '\0';
+            sets[count++] = v + 1;
+        }
+    if ((v = strchr(v, ';')) != NULL)   //sets past max
+        *v = '\0';
+    return count;
+}
+
+//Facts about a page computed once by driver before any compression or layout sees the page.
+//Use them to skip passes over the page that were already done by driver.
+struct page_features
+{
+    uint8_t * data;                 //start of page
+    uint64_t index;                 //index of page in dump, same as index of page_report
+    uint8_t zero_line[PAGE_SIZE/CACHELINE_SIZE];    //1 if cacheline is filled with 0
+    int zero_page;                  //1 if all cachelines are filled with 0
+    uint32_t histogram[256];        //byte occurrence
+    double entropy;                 //Shannon entropy of bytes, in bits per byte
+    uint32_t repeated_words;        //count of 8-byte words equal to the word before it
+    int same_filled;                //1 if page is one 8-byte value repeated
+    uint32_t word_width[9];         //count of 8-byte words by significant bytes (0 to 8)
+    uint64_t history;               //bytes of the same thread slice before this page. data - history is readable
 };
 
 struct compression;
 //function call for compression, returns compressed size in bits. NULL on error.
-typedef uint64_t (* run_compression_t) (struct compression * c_p, uint8_t * data_to_compress, uint16_t ** malloc_cacheline_report_on_demand);
+typedef uint64_t (* run_compression_t) (struct compression * c_p, uint8_t * data_to_compress, uint16_t ** malloc_cacheline_report_on_demand, struct page_features * features);
+//Clean up per-thread objects (i.e. reusable streams) before a thread exits, pre-pass threads included. Optional, leave NULL if not used
+typedef void (* compression_thread_clean_t) (struct compression * c_p);
+//Compress a block smaller than a page, size divides PAGE_SIZE. returns compressed size in bits. Optional, for -g
+typedef uint64_t (* run_block_compression_t) (struct compression * c_p, uint8_t * data_to_compress, int size);
+//Scan a sampled page in pre-pass before any page is compressed. Multithreaded, use per-thread objects and merge them in thread clean. Optional
+typedef void (* compression_sample_t) (struct compression * c_p, uint8_t * data, struct page_features * features);
+//Decompress line of CACHELINE_SIZE bytes, or the whole page if line < 0, from compressed data of the last page this thread compressed with c_p. For -D. Optional
+//Page-level compressions decompress the page up to the end of the line
+typedef void (* run_decompression_t) (struct compression * c_p, int line);
+//Prepare before any page is compressed and after pre-pass, i.e. sample a dictionary from the measured part of dump. Optional
+typedef void (* compression_init_t) (struct compression * c_p, uint8_t * dump, uint64_t size);
+//Clean up before exit. Measurement of the compression can also be printed here. Optional
+typedef void (* compression_clean_t) (struct compression * c_p);
+//Read -c options right after the shared object is loaded, before the list is built. sharedv is set.
+//Nodes may be linked after c_p here, i.e. one for each set of options. Optional
+typedef void (* compression_configure_t) (struct compression * c_p);
 
 //this structure will be chained as a list to be run by driver
 //manually adding multiple compressions in one .so is allowed. 
@@ -68,6 +145,29 @@ struct compression //name it compression_node so driver can access it
     uint64_t size;              //reserved
     struct shared * sharedv;    //reserved for shared variables
     uint16_t * page_report;     //reserved, will hold compressed page size in bits.
+    compression_thread_clean_t thread_clean;   //optional. Will run in the end before each thread exits
+    int prefilter;              //set to 1 to allow driver to report high entropy pages as uncompressed without calling compress
+    uint64_t prefilter_skip;    //reserved, pages skipped by prefilter
+    uint64_t prefilter_false;   //reserved, skipped pages that compress below page size. Counted with prefilter_verify
+    run_block_compression_t compress_block; //optional. implement this for page-level compression to be measured in smaller units
+    struct compression * parent;            //reserved, compression measured by this node in units of granularity
+    int granularity;                        //reserved, in bytes
+    compression_init_t init;                //optional. Will run once after dump is mapped, before any page
+    compression_sample_t sample;            //optional. Pre-pass will run before init if any compression samples
+    int cacheable;              //set to 1 if results only depend on page content, to allow driver to keep them in -r cache
+    int version;                //optional. Change it when results of the compression change, to invalidate -r cache entries
+    uint64_t cache_id;          //reserved
+    uint64_t cache_hit;         //reserved, pages found in -r cache
+    uint64_t cache_lookup;      //reserved, pages looked up in -r cache
+    int column;                 //reserved, position in -w results, -1 for layout reports
+    int snapshot_column;        //reserved, column in -b baseline results, -1 if not there
+    uint64_t snapshot_before;   //reserved, size of pages changed since -b baseline, in baseline
+    uint64_t snapshot_after;    //reserved, size of pages changed since -b baseline, now
+    run_decompression_t decompress;     //optional. implement this to be timed by -D
+    uint64_t * decompress_hist;         //reserved, -D histograms of ns per page and ns per line
+    compression_clean_t clean;              //optional. Will run once in the end after results are printed
+    compression_configure_t configure;      //optional. Will run once on the first node when loaded
+    int not_size;               //set to 1 if compress returns something other than a compressed size. Layouts taking every compression leave it out
 };
 
 //current layout only perform calculations
@@ -76,10 +176,12 @@ struct compression //name it compression_node so driver can access it
 typedef void (* layout_init_t) (struct compression ** begin_of_linked_list);
 //gather data from compression. will be called after every single page is comrpessed in every compression
 //notice: this is multithreaded. Use locks and per-thread objects
-typedef void (* layout_page_report_t) (struct compression * c_p, uint16_t cacheline_report[PAGE_SIZE/CACHELINE_SIZE], uint16_t page_size);
+typedef void (* layout_page_report_t) (struct compression * c_p, uint16_t cacheline_report[PAGE_SIZE/CACHELINE_SIZE], uint16_t page_size, struct page_features * features);
 //This gives all compression with page reports to layout.
-//You can perform essential calculations here. There is no other thread runninng with this call
-//notice: This is not multithreaded, implement your own multithreaded program to speed up
+//You can perform essential calculations here, after compressions are done. Use sharedv->parallel_for over page indices to speed up
+//notice: final reports of layouts with final_independent set run concurrently with each other, before the others.
+//They may only read page_report and size of compressions, and must not touch state shared with other layouts.
+//Final reports of other layouts run one at a time
 typedef void (* layout_final_report_t) (struct compression * begin_of_linked_list, uint64_t totalpages);
 //Clean up before a thread exit. 
 typedef void (* layout_thread_clean_t) ();
@@ -101,4 +203,5 @@ struct layout
     struct compression * reports;       //dummy reports to print in results alongside with compressions
     int report_count;                   //count of dummy reports
     struct shared * sharedv;            //reserved for shared variables
+    int final_independent;              //1 if L_final_r does not need L_final_r of other layouts to be done
 };
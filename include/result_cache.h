@@ -0,0 +1,226 @@
+/*
+
+    Persistent result cache for driver.
+
+    Compressed size and cacheline report of a page are kept in a memory mapped file,
+    keyed by the 128-bit hash of the page and the name, version and options of the compression.
+    The file is shared across runs and dumps, so recurring pages are not compressed again.
+    Runs using the same file should not overlap.
+
+    The file is a set-associative table of RESULT_CACHE_WAYS entries per set.
+    Each set has a sequence lock: lookups never block and retry if a writer was active,
+    writers of the same set take turns. A full set evicts the entry least recently used,
+    by run, so entries used by recent runs are kept.
+    A run that ends without closing the cache leaves it dirty. The next open drops sets
+    that were being written, as their entries may be torn.
+
+    HEAP Lab, Virginia Tech
+    Oct 2019
+*/
+
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <pagehash.h>
+
+#define RESULT_CACHE_MAGIC (0x3143524d434d4d43ull) //"CMMCMRC1"
+#define RESULT_CACHE_WAYS (8)
+#define RESULT_CACHE_REPORT (1)    //flag, entry has cacheline report
+
+struct result_cache_entry
+{
+    uint64_t lo, hi;    //key, lo is 0 if empty
+    uint32_t size;      //compressed size in bits
+    uint16_t flags;
+    uint16_t pad;
+    uint32_t used;      //run that last used the entry
+    uint32_t pad2;
+    uint16_t report[PAGE_SIZE / CACHELINE_SIZE];
+};
+
+struct result_cache_set
+{
+    uint32_t seq;       //odd while written
+    uint32_t pad[3];
+    struct result_cache_entry way[RESULT_CACHE_WAYS];
+};
+
+struct result_cache_header
+{
+    uint64_t magic;
+    uint32_t page_size;
+    uint32_t cacheline_size;
+    uint64_t sets;
+    uint32_t run;       //incremented by each run that opens the cache
+    uint32_t dirty;     //set while a run has the cache open
+    uint64_t pad2[4];
+};
+
+struct result_cache
+{
+    struct result_cache_header * header;
+    struct result_cache_set * set;
+    uint64_t sets;
+    uint64_t bytes;
+    uint32_t run;
+    uint64_t evictions;
+};
+
+//key of page for compression with id, see result_cache_id
+static inline struct pagehash result_cache_key(struct pagehash page, uint64_t id)
+{
+    struct pagehash k;
+    k.lo = pagehash_fmix(page.lo ^ id);
+    k.hi = page.hi + id * PAGEHASH_P1;
+    k.lo += !k.lo;
+    return k;
+}
+
+//id of compression from its name, version and a hash of options its results depend on
+static inline uint64_t result_cache_id(char * name, int version, uint64_t options)
+{
+    uint8_t buf[64] = {0};
+    strncpy((char *)buf, name, 48);
+    memcpy(buf + 48, &options, sizeof(uint64_t));
+    memcpy(buf + 56, &version, sizeof(int));
+    return pagehash_compute(buf, 64).lo;
+}
+
+/*
+    Opens or creates cache file of about bytes long. The file is cleared if it was made
+    with a different size or geometry. Returns 0 on error
+*/
+static int result_cache_open(struct result_cache * c, char * fn, uint64_t bytes)
+{
+    uint64_t sets = (bytes - sizeof(struct result_cache_header)) / sizeof(struct result_cache_set);
+    if (bytes <= sizeof(struct result_cache_header) || sets == 0)
+        return 0;
+    bytes = sizeof(struct result_cache_header) + sets * sizeof(struct result_cache_set);
+    int fd = open(fn, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return 0;
+    off_t old = lseek(fd, 0, SEEK_END);
+    if (old != bytes && ftruncate(fd, bytes) != 0)
+    {
+        close(fd);
+        return 0;
+    }
+    void * m = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED)
+        return 0;
+    c->header = m;
+    c->set = (struct result_cache_set *)(c->header + 1);
+    c->sets = sets;
+    c->bytes = bytes;
+    c->evictions = 0;
+    if (old != bytes || c->header->magic != RESULT_CACHE_MAGIC || c->header->sets != sets
+        || c->header->page_size != PAGE_SIZE || c->header->cacheline_size != CACHELINE_SIZE)
+    {
+        memset(m, 0, bytes);
+        c->header->magic = RESULT_CACHE_MAGIC;
+        c->header->page_size = PAGE_SIZE;
+        c->header->cacheline_size = CACHELINE_SIZE;
+        c->header->sets = sets;
+    }
+    else if (c->header->dirty)
+    {
+        //last run did not finish, a set with odd sequence was left mid write
+        uint64_t i;
+        for (i = 0; i < sets; i++)
+            if (c->set[i].seq & 1)
+                memset(&c->set[i], 0, sizeof(struct result_cache_set));
+    }
+    c->header->dirty = 1;
+    c->run = ++c->header->run;
+    return 1;
+}
+
+static void result_cache_close(struct result_cache * c)
+{
+    c->header->dirty = 0;
+    munmap(c->header, c->bytes);
+}
+
+/*
+    Looks up key. On hit, size is written and a cacheline report is malloced to report if the entry has one.
+    Returns 1 on hit
+*/
+static int result_cache_lookup(struct result_cache * c, struct pagehash k, uint64_t * size, uint16_t ** report)
+{
+    struct result_cache_set * s = c->set + k.lo % c->sets;
+    uint16_t r[PAGE_SIZE / CACHELINE_SIZE];
+    uint32_t seq, found, flags = 0, w = 0;
+    do
+    {
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        found = 0;
+        if (seq & 1)
+            continue;
+        for (w = 0; w < RESULT_CACHE_WAYS; w++)
+            if (s->way[w].lo == k.lo && s->way[w].hi == k.hi)
+            {
+                found = 1;
+                *size = s->way[w].size;
+                flags = s->way[w].flags;
+                if (flags & RESULT_CACHE_REPORT)
+                    memcpy(r, s->way[w].report, sizeof(r));
+                break;
+            }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }
+    while ((seq & 1) || seq != __atomic_load_n(&s->seq, __ATOMIC_RELAXED));
+    if (!found)
+        return 0;
+    if (s->way[w].used != c->run)
+        __atomic_store_n(&s->way[w].used, c->run, __ATOMIC_RELAXED);    //a hint for eviction, races are harmless
+    if (flags & RESULT_CACHE_REPORT)
+    {
+        *report = malloc(sizeof(r));
+        memcpy(*report, r, sizeof(r));
+    }
+    return 1;
+}
+
+//Inserts result of key. report can be NULL
+static void result_cache_insert(struct result_cache * c, struct pagehash k, uint64_t size, uint16_t * report)
+{
+    struct result_cache_set * s = c->set + k.lo % c->sets;
+    uint32_t seq, w, victim = RESULT_CACHE_WAYS;
+    if (size > UINT32_MAX)
+        return;
+    do
+        seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED) & ~1u;
+    while (!__atomic_compare_exchange_n(&s->seq, &seq, seq + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    //empty or same key first, then the least recently used starting from a way picked by key
+    for (w = 0; w < RESULT_CACHE_WAYS && victim == RESULT_CACHE_WAYS; w++)
+        if (s->way[w].lo == 0 || (s->way[w].lo == k.lo && s->way[w].hi == k.hi))
+            victim = w;
+    if (victim == RESULT_CACHE_WAYS)
+    {
+        uint32_t start = (k.hi >> 32) % RESULT_CACHE_WAYS;
+        victim = start;
+        for (w = 1; w < RESULT_CACHE_WAYS; w++)
+            if (s->way[(start + w) % RESULT_CACHE_WAYS].used < s->way[victim].used)
+                victim = (start + w) % RESULT_CACHE_WAYS;
+        __atomic_fetch_add(&c->evictions, 1, __ATOMIC_RELAXED);
+    }
+    struct result_cache_entry * e = &s->way[victim];
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    e->lo = k.lo;
+    e->hi = k.hi;
+    e->size = size;
+    e->used = c->run;
+    e->flags = report != NULL ? RESULT_CACHE_REPORT : 0;
+    if (report != NULL)
+        memcpy(e->report, report, sizeof(e->report));
+    __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+#endif
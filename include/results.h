@@ -0,0 +1,223 @@
+/*
+
+    Columnar per-page results file of driver (-o), for analysis after the run without compressing again.
+
+    Header, column table and segment map, then one page-aligned column of each kind:
+        page sizes in bits of each compression and layout report, uint16_t by page
+        zero cachelines of all pages, a bitmap of LINES bits by page
+        with -o file,lines, cacheline reports of each column, uint16_t by cacheline of each page
+    Sizes above RESULTS_MAX are RESULTS_MAX. Zero pages have RESULTS_ZERO when zero pages are not measured,
+    cachelines of pages without a report have RESULTS_ZERO. Cacheline sizes are as layouts get them, see IS_ZERO_CACHELINE.
+    Columns are written by workers from per-thread buffers with pwrite, the header is written last.
+    A failed write marks the file, and results_close reports it.
+    Map the file with results_open to read columns in place.
+
+    HEAP Lab, Virginia Tech
+    Oct 2019
+*/
+
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <dump.h>
+
+#define RESULTS_MAGIC (0x31534552534d4d43ull)  //"CMMSRES1"
+#define RESULTS_ZERO (UINT16_MAX)
+#define RESULTS_MAX (UINT16_MAX - 1)
+#define RESULTS_LINES (PAGE_SIZE / CACHELINE_SIZE)
+#define RESULTS_ZERO_BYTES ((RESULTS_LINES + 7) / 8)    //bytes of zero cacheline bitmap of a page
+#define RESULTS_ALIGN (4096)
+
+enum {RESULTS_COMPRESSION, RESULTS_LAYOUT};
+
+struct results_header
+{
+    uint64_t magic;
+    uint32_t page_size;
+    uint32_t cacheline_size;
+    uint64_t pages;
+    uint64_t start;             //measured part of dump, start to end in bytes
+    uint64_t end;
+    uint32_t columns;
+    uint32_t segments;
+    int32_t parse_switch;
+    int32_t zero_switch;
+    int32_t lines;              //1 if cacheline columns are kept
+    int32_t pad0;
+    uint64_t zero_offset;       //offset of zero cacheline bitmap
+    char filename[256];         //dump
+    uint64_t pad[8];
+};
+
+struct results_column
+{
+    char name[48];
+    int32_t version;
+    int32_t kind;               //RESULTS_COMPRESSION or RESULTS_LAYOUT
+    uint64_t offset;            //offset of page sizes
+    uint64_t line_offset;       //offset of cacheline sizes, 0 if not kept
+    int32_t has_lines;          //1 if any page had a cacheline report
+    int32_t pad;
+};
+
+struct results
+{
+    int fd;                     //writing, -1 if mapped for reading
+    struct results_header * header;
+    struct results_column * column;
+    struct dump_segment * segment;
+    uint8_t * map;
+    uint64_t bytes;
+    int error;                  //1 if a write failed
+};
+
+static inline uint64_t results_align(uint64_t x)
+{
+    return (x + RESULTS_ALIGN - 1) & ~(uint64_t)(RESULTS_ALIGN - 1);
+}
+
+//Writes all of buf at offset, retrying short writes. Marks r on error. Safe from any thread
+static inline void results_pwrite(struct results * r, void * buf, uint64_t bytes, uint64_t offset)
+{
+    uint8_t * b = buf;
+    while (bytes > 0)
+    {
+        ssize_t n = pwrite(r->fd, b, bytes, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            __atomic_store_n(&r->error, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        b += n;
+        offset += n;
+        bytes -= n;
+    }
+}
+
+//Creates results file of columns for pages, with its segment map. Columns are named with results_name. Returns 0 on error
+static inline int results_create(struct results * r, char * fn, uint32_t columns, uint64_t pages, int lines, struct dump_segment * seg, int segs)
+{
+    uint64_t i, offset = results_align(sizeof(struct results_header) + sizeof(struct results_column) * columns
+        + sizeof(struct dump_segment) * segs);
+    r->fd = open(fn, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    r->error = 0;
+    if (r->fd < 0)
+        return 0;
+    r->map = calloc(1, offset);
+    r->header = (struct results_header *)r->map;
+    r->column = (struct results_column *)(r->header + 1);
+    r->segment = (struct dump_segment *)(r->column + columns);
+    r->header->magic = RESULTS_MAGIC;
+    r->header->page_size = PAGE_SIZE;
+    r->header->cacheline_size = CACHELINE_SIZE;
+    r->header->pages = pages;
+    r->header->columns = columns;
+    r->header->segments = segs;
+    r->header->lines = lines;
+    if (segs)
+        memcpy(r->segment, seg, sizeof(struct dump_segment) * segs);
+    for (i = 0; i < columns; i++)
+    {
+        r->column[i].offset = offset;
+        offset = results_align(offset + sizeof(uint16_t) * pages);
+    }
+    r->header->zero_offset = offset;
+    offset = results_align(offset + RESULTS_ZERO_BYTES * pages);
+    for (i = 0; i < columns && lines; i++)
+    {
+        r->column[i].line_offset = offset;
+        offset = results_align(offset + sizeof(uint16_t) * RESULTS_LINES * pages);
+    }
+    r->bytes = offset;
+    if (ftruncate(r->fd, r->bytes) != 0)
+    {
+        close(r->fd);
+        free(r->map);
+        return 0;
+    }
+    return 1;
+}
+
+static inline void results_name(struct results * r, int i, const char * name, int version, int kind)
+{
+    strncpy(r->column[i].name, name, sizeof(r->column[i].name) - 1);
+    r->column[i].version = version;
+    r->column[i].kind = kind;
+}
+
+//Writes sizes of count pages from first page of column. Safe from any thread
+static inline void results_write(struct results * r, int column, uint64_t first, uint16_t * sizes, uint64_t count)
+{
+    results_pwrite(r, sizes, sizeof(uint16_t) * count, r->column[column].offset + sizeof(uint16_t) * first);
+}
+
+static inline void results_write_lines(struct results * r, int column, uint64_t first, uint16_t * sizes, uint64_t count)
+{
+    results_pwrite(r, sizes, sizeof(uint16_t) * RESULTS_LINES * count,
+        r->column[column].line_offset + sizeof(uint16_t) * RESULTS_LINES * first);
+}
+
+static inline void results_write_zero(struct results * r, uint64_t first, uint8_t * bitmap, uint64_t count)
+{
+    results_pwrite(r, bitmap, RESULTS_ZERO_BYTES * count, r->header->zero_offset + RESULTS_ZERO_BYTES * first);
+}
+
+//Writes header, column table and segment map, and closes file. Returns 0 if any write of the file failed
+static inline int results_close(struct results * r)
+{
+    uint64_t bytes = results_align(sizeof(struct results_header) + sizeof(struct results_column) * r->header->columns
+        + sizeof(struct dump_segment) * r->header->segments);
+    results_pwrite(r, r->map, bytes, 0);
+    if (close(r->fd) != 0)
+        r->error = 1;
+    free(r->map);
+    return !r->error;
+}
+
+//Maps results file read only. Returns 0 on error
+static inline int results_open(struct results * r, char * fn)
+{
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    off_t bytes = lseek(fd, 0, SEEK_END);
+    void * m = bytes >= sizeof(struct results_header) ? mmap(0, bytes, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (m == MAP_FAILED)
+        return 0;
+    r->fd = -1;
+    r->map = m;
+    r->bytes = bytes;
+    r->header = m;
+    r->column = (struct results_column *)(r->header + 1);
+    r->segment = (struct dump_segment *)(r->column + r->header->columns);
+    if (r->header->magic != RESULTS_MAGIC || r->header->page_size != PAGE_SIZE || r->header->cacheline_size != CACHELINE_SIZE
+        || (uint8_t *)(r->segment + r->header->segments) > r->map + bytes || r->header->zero_offset > bytes)
+    {
+        munmap(m, bytes);
+        return 0;
+    }
+    return 1;
+}
+
+//Page sizes of column in mapped file
+static inline uint16_t * results_sizes(struct results * r, int column)
+{
+    return (uint16_t *)(r->map + r->column[column].offset);
+}
+
+static inline void results_unmap(struct results * r)
+{
+    munmap(r->map, r->bytes);
+}
+
+#endif
@@ -0,0 +1,186 @@
+/*
+
+    Statistical cache compression (SC2) with a global Huffman code over 32-bit words.
+    Based on: A. Arelakis and P. Stenstrom, "SC2: A Statistical Compression Cache Scheme", ISCA 2014
+
+    The code is built once from value counts of sampled memory and shared by every cacheline.
+    The most frequent SC2_VALUES values get codewords, other values are sent
+    as escape codeword followed by the 32-bit value.
+    Codewords are limited to SC2_MAX_DEPTH bits. Encoding is a table lookup per word.
+
+    HEAP Lab, Virginia Tech
+    Oct 2019
+*/
+
+#ifndef SC2_H
+#define SC2_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <package_merge.h>
+
+#define SC2_VALUES (1024)           //values with codewords, size of value frequency table
+#define SC2_SYMBOLS (SC2_VALUES + 1)
+#define SC2_ESCAPE (SC2_VALUES)     //symbol of values without codeword
+#define SC2_MAX_DEPTH (16)
+#define SC2_TABLE_BITS (12)         //encoder lookup table, 4 times of SC2_VALUES
+#define SC2_EMPTY (0xffff)
+#define SC2_LINE_WORDS (16)         //32-bit words in a 64 byte cacheline
+
+struct sc2_code
+{
+    int values;                                 //values with codeword, symbols are 0 to values - 1
+    uint32_t value[SC2_VALUES];
+    uint8_t len[SC2_SYMBOLS];
+    uint32_t code[SC2_SYMBOLS];
+    uint32_t key[1 << SC2_TABLE_BITS];          //encoder lookup, value to symbol by open addressing
+    uint16_t sym[1 << SC2_TABLE_BITS];
+    uint32_t first[SC2_MAX_DEPTH + 1];          //canonical decoder, first codeword of each length
+    uint16_t count[SC2_MAX_DEPTH + 1];
+    uint16_t offset[SC2_MAX_DEPTH + 1];
+    uint16_t sorted[SC2_SYMBOLS];               //symbols by codeword
+};
+
+static inline uint32_t SC2_hash(uint32_t v)
+{
+    return (v * 0x9E3779B1u) >> (32 - SC2_TABLE_BITS);
+}
+
+/*
+ * Builds the global code. value and count hold n <= SC2_VALUES values sorted by ascending count,
+ * escape is the count of all other sampled words.
+ */
+static void SC2_build(struct sc2_code * c, uint32_t * value, uint64_t * count, int n, uint64_t escape)
+{
+    uint64_t weight[SC2_SYMBOLS];
+    uint8_t len[SC2_SYMBOLS];
+    uint16_t order[SC2_SYMBOLS];
+    int i, j, l;
+    memset(c, 0, sizeof(struct sc2_code));
+    c->values = n;
+    //escape is inserted in order of weight. Weights are at least 1 so every symbol gets a codeword
+    escape = escape ? escape : 1;
+    for (i = j = 0; i <= n; i++)
+        if (j == i && (i == n || escape <= count[j]))
+        {
+            weight[i] = escape;
+            order[i] = SC2_ESCAPE;
+        }
+        else
+        {
+            weight[i] = count[j] ? count[j] : 1;
+            order[i] = j++;
+        }
+    if (n == 0)
+        len[0] = 1;
+    else
+        package_merge(weight, n + 1, SC2_MAX_DEPTH, len);
+    for (i = 0; i < n; i++)
+        c->value[i] = value[i];
+    for (i = 0; i <= n; i++)
+    {
+        c->len[order[i]] = len[i];
+        c->count[len[i]]++;
+    }
+    //canonical codewords, shorter first
+    uint32_t code = 0;
+    int k = 0;
+    for (l = 1; l <= SC2_MAX_DEPTH; l++)
+    {
+        c->first[l] = code;
+        c->offset[l] = k;
+        for (i = n; i >= 0; i--)
+            if (len[i] == l)
+            {
+                c->code[order[i]] = code++;
+                c->sorted[k++] = order[i];
+            }
+        code <<= 1;
+    }
+    for (i = 0; i < (1 << SC2_TABLE_BITS); i++)
+        c->sym[i] = SC2_EMPTY;
+    for (i = 0; i < n; i++)
+    {
+        uint32_t h;
+        for (h = SC2_hash(value[i]); c->sym[h] != SC2_EMPTY; h = (h + 1) & ((1 << SC2_TABLE_BITS) - 1));
+        c->key[h] = value[i];
+        c->sym[h] = i;
+    }
+}
+
+static inline int SC2_symbol(struct sc2_code * c, uint32_t v)
+{
+    uint32_t h;
+    for (h = SC2_hash(v); c->sym[h] != SC2_EMPTY; h = (h + 1) & ((1 << SC2_TABLE_BITS) - 1))
+        if (c->key[h] == v)
+            return c->sym[h];
+    return SC2_ESCAPE;
+}
+
+//Returns encoded size of a cacheline in bits without writing it
+static inline int SC2_line_size(struct sc2_code * c, uint32_t * words)
+{
+    int i, s = 0;
+    for (i = 0; i < SC2_LINE_WORDS; i++)
+    {
+        int sym = SC2_symbol(c, words[i]);
+        s += c->len[sym] + (sym == SC2_ESCAPE ? 32 : 0);
+    }
+    return s;
+}
+
+//dest should be at least SC2_LINE_WORDS * (4 + SC2_MAX_DEPTH / 8) bytes long. Returns size in bits
+static int SC2_encode_line(struct sc2_code * c, uint32_t * words, uint8_t * dest)
+{
+    uint64_t buf = 0;
+    int i, bits = 0, s = 0;
+    for (i = 0; i < SC2_LINE_WORDS; i++)
+    {
+        int sym = SC2_symbol(c, words[i]);
+        buf = (buf << c->len[sym]) | c->code[sym];
+        bits += c->len[sym];
+        if (sym == SC2_ESCAPE)
+        {
+            buf = (buf << 32) | words[i];
+            bits += 32;
+        }
+        for (; bits >= 8; bits -= 8, s += 8)
+            *dest++ = buf >> (bits - 8);
+    }
+    if (bits)
+        *dest = buf << (8 - bits);
+    return s + bits;
+}
+
+//Decodes a cacheline to words. Returns size in bits
+static int SC2_decode_line(struct sc2_code * c, uint8_t * src, uint32_t * words)
+{
+    int i, pos = 0;
+    for (i = 0; i < SC2_LINE_WORDS; i++)
+    {
+        uint32_t code = 0;
+        int l;
+        for (l = 1; l <= SC2_MAX_DEPTH; l++, pos++)
+        {
+            code = (code << 1) | ((src[pos / 8] >> (7 - pos % 8)) & 1);
+            if (code - c->first[l] < c->count[l])
+                break;
+        }
+        pos++;
+        int sym = c->sorted[c->offset[l] + code - c->first[l]];
+        if (sym != SC2_ESCAPE)
+            words[i] = c->value[sym];
+        else
+        {
+            int k;
+            words[i] = 0;
+            for (k = 0; k < 32; k++, pos++)
+                words[i] = (words[i] << 1) | ((src[pos / 8] >> (7 - pos % 8)) & 1);
+        }
+    }
+    return pos;
+}
+
+#endif
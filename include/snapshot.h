@@ -0,0 +1,133 @@
+/*
+
+    Per-page results file of driver, for snapshot diff (-w writes it, -b reads it).
+
+    Header, then one column per compression with its name and version,
+    then one record per page of the dump: page hash and size in bits of each column.
+    Sizes are taken after prefilter and page size limit, so runs compared should use the same options.
+    A size of a page reported as uncompressed by prefilter has SNAPSHOT_SKIPPED set, and SNAPSHOT_FALSE_SKIP
+    too if prefilter_verify found it compressible, so a later run reusing the size counts the page the same.
+
+    HEAP Lab, Virginia Tech
+    Oct 2019
+*/
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <pagehash.h>
+
+#define SNAPSHOT_MAGIC (0x3150414e534d4d43ull) //"CMMSNAP1"
+#define SNAPSHOT_NONE (UINT32_MAX)            //size of zero pages, and compressions not run
+#define SNAPSHOT_SKIPPED (1u << 31)           //flags of size, see above
+#define SNAPSHOT_FALSE_SKIP (1u << 30)
+#define SNAPSHOT_SIZE(s) ((s) & ~(SNAPSHOT_SKIPPED | SNAPSHOT_FALSE_SKIP))
+
+struct snapshot_header
+{
+    uint64_t magic;
+    uint32_t page_size;
+    uint32_t columns;
+    uint64_t pages;
+    int32_t parse_switch;
+    int32_t zero_switch;
+    double prefilter;
+    uint64_t pad[4];
+};
+
+struct snapshot_column
+{
+    char name[56];
+    int32_t version;
+    uint32_t pad;
+};
+
+struct snapshot_record
+{
+    struct pagehash hash;   //0 if page was not hashed (zero page)
+    uint32_t size[];
+};
+
+struct snapshot
+{
+    struct snapshot_header * header;
+    struct snapshot_column * column;
+    uint8_t * records;
+    uint64_t record_size;
+    uint64_t bytes;
+};
+
+static void snapshot_layout(struct snapshot * s)
+{
+    s->column = (struct snapshot_column *)(s->header + 1);
+    s->records = (uint8_t *)(s->column + s->header->columns);
+    s->record_size = (sizeof(struct snapshot_record) + sizeof(uint32_t) * s->header->columns + 7) & ~7ull;
+}
+
+static inline struct snapshot_record * snapshot_record(struct snapshot * s, uint64_t page)
+{
+    return (struct snapshot_record *)(s->records + page * s->record_size);
+}
+
+//Maps results file read only. Returns 0 on error
+static int snapshot_open(struct snapshot * s, char * fn)
+{
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    off_t bytes = lseek(fd, 0, SEEK_END);
+    void * m = bytes >= sizeof(struct snapshot_header) ? mmap(0, bytes, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (m == MAP_FAILED)
+        return 0;
+    s->header = m;
+    s->bytes = bytes;
+    snapshot_layout(s);
+    if (s->header->magic != SNAPSHOT_MAGIC || s->header->page_size != PAGE_SIZE
+        || s->records + s->header->pages * s->record_size > (uint8_t *)m + bytes)
+    {
+        munmap(m, bytes);
+        return 0;
+    }
+    return 1;
+}
+
+//Creates results file for pages and columns, records are filled by caller. Returns 0 on error
+static int snapshot_create(struct snapshot * s, char * fn, uint32_t columns, uint64_t pages)
+{
+    uint64_t record_size = (sizeof(struct snapshot_record) + sizeof(uint32_t) * columns + 7) & ~7ull;
+    uint64_t bytes = sizeof(struct snapshot_header) + sizeof(struct snapshot_column) * columns + record_size * pages;
+    int fd = open(fn, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return 0;
+    if (ftruncate(fd, bytes) != 0)
+    {
+        close(fd);
+        return 0;
+    }
+    void * m = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED)
+        return 0;
+    s->header = m;
+    s->bytes = bytes;
+    s->header->magic = SNAPSHOT_MAGIC;
+    s->header->page_size = PAGE_SIZE;
+    s->header->columns = columns;
+    s->header->pages = pages;
+    snapshot_layout(s);
+    return 1;
+}
+
+static void snapshot_close(struct snapshot * s)
+{
+    munmap(s->header, s->bytes);
+}
+
+#endif
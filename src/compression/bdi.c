@@ -10,15 +10,33 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include <bdi.h>
 #include <plugin_struct.h>
 
 struct compression COMPRESSION_NODE_NAME;
 
-static uint64_t bdi_compression(struct compression * c_p, uint8_t * start, uint16_t ** report)
+enum bdi_line {BDI_COMPRESSED, BDI_ZERO, BDI_RAW};
+
+//last page compressed by this thread, kept for -D
+static __thread uint8_t bdi_saved[PAGE_SIZE / 64][65];
+static __thread uint8_t bdi_kind[PAGE_SIZE / 64];
+static __thread uint8_t * bdi_page;
+static __thread uint8_t bdi_out[PAGE_SIZE];
+
+//size of a zero cacheline in bytes, same for every page, computed once at load
+static int bdi_zero_size;
+
+static void bdi_configure(struct compression * c_p)
 {
+    uint8_t zero[64] = {0};
     uint8_t bditemp[65];
+    bdi_zero_size = bdiCompressData(zero, bditemp);
+}
+
+static uint64_t bdi_compression(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f)
+{
     uint8_t bdirev[64];
     uint64_t i, cache_size = 0;
     if (CACHELINE_SIZE % 64 == 0) // aligned to multiple
@@ -26,9 +44,15 @@ static uint64_t bdi_compression(struct compression * c_p, uint8_t * start, uint1
     uint64_t sum = 0;
     for (i = 0; i < PAGE_SIZE; i += 64)//cacheline size is fixed here for compression
     {
-        int s = bdiCompressData(start + i, bditemp); // in bytes
-        if (COMPRESSION_NODE_NAME.sharedv->parse_switch)
-            s = s > 64 ? 64 : s;
+        uint8_t * bditemp = bdi_saved[i / 64];
+        int zero = CACHELINE_SIZE == 64 && f->zero_line[i / 64];   //skip zero lines found by driver
+        int s = zero ? bdi_zero_size : bdiCompressData(start + i, bditemp); // in bytes
+        bdi_kind[i / 64] = zero ? BDI_ZERO : BDI_COMPRESSED;
+        if (COMPRESSION_NODE_NAME.sharedv->parse_switch && s >= 64)
+        {
+            s = 64;
+            bdi_kind[i / 64] = BDI_RAW;
+        }
         s *= 8;
         cache_size += s;
         if (report != NULL && (i + 64) % CACHELINE_SIZE == 0)
@@ -37,7 +61,7 @@ static uint64_t bdi_compression(struct compression * c_p, uint8_t * start, uint1
             cache_size = 0;
         }
         sum += s;
-        if (COMPRESSION_NODE_NAME.sharedv->validate && !(s >= 64 * 8 && COMPRESSION_NODE_NAME.sharedv->parse_switch))
+        if (COMPRESSION_NODE_NAME.sharedv->validate && !zero && !(s >= 64 * 8 && COMPRESSION_NODE_NAME.sharedv->parse_switch))
         {
             bdiDecompressData(bditemp,bdirev);
             int j;
@@ -49,11 +73,28 @@ static uint64_t bdi_compression(struct compression * c_p, uint8_t * start, uint1
                 }
         }
     }
+    bdi_page = start;
     return sum;
 }
 
+static void bdi_decompression(struct compression * c_p, int line)
+{
+    int i = line < 0 ? 0 : line * CACHELINE_SIZE / 64;
+    int end = line < 0 ? PAGE_SIZE / 64 : ((line + 1) * CACHELINE_SIZE + 63) / 64;
+    for (; i < end; i++)
+        if (bdi_kind[i] == BDI_COMPRESSED)
+            bdiDecompressData(bdi_saved[i], bdi_out + i * 64);
+        else if (bdi_kind[i] == BDI_ZERO)
+            memset(bdi_out + i * 64, 0, 64);
+        else
+            memcpy(bdi_out + i * 64, bdi_page + i * 64, 64);
+}
+
 struct compression COMPRESSION_NODE_NAME = {
     .next = NULL,
     .name = "bdi",
-    .compress = (run_compression_t)bdi_compression
+    .compress = (run_compression_t)bdi_compression,
+    .decompress = (run_decompression_t)bdi_decompression,
+    .configure = (compression_configure_t)bdi_configure,
+    .cacheable = 1
 };
\ No newline at end of file
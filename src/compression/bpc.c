@@ -10,22 +10,44 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include <bpc.h>
 #include <plugin_struct.h>
 
 struct compression COMPRESSION_NODE_NAME;
 
-static uint64_t bpc_compression(struct compression * c_p, uint8_t * start, uint16_t ** report)
+enum bpc_block {BPC_COMPRESSED, BPC_ZERO, BPC_RAW};
+
+//last page compressed by this thread, kept for -D
+static __thread uint8_t bpc_saved[PAGE_SIZE / 128][34*4+1];
+static __thread uint8_t bpc_kind[PAGE_SIZE / 128];
+static __thread uint8_t * bpc_page;
+static __thread uint32_t bpc_out[PAGE_SIZE / 4];
+
+//size of a zero 128-byte block in bits, same for every page, computed once at load
+static int bpc_zero_size;
+
+static void bpc_configure(struct compression * c_p)
 {
+    uint32_t zero[32] = {0};
     uint8_t bpctemp[34*4+1];
+    bpc_zero_size = bpcCompressData(zero, bpctemp);
+}
+
+static uint64_t bpc_compression(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f)
+{
     uint32_t bpcrev[32];
     uint64_t i;
     uint64_t sum = 0;
     for (i = 0; i < PAGE_SIZE; i += 128)//cacheline size is fixed here for compression
     {
-        int s = bpcCompressData(((uint32_t *)(start + i)), bpctemp); // in bits
-        if (COMPRESSION_NODE_NAME.sharedv->validate)
+        //skip zero blocks found by driver
+        uint8_t * bpctemp = bpc_saved[i / 128];
+        int zero = CACHELINE_SIZE == 64 && f->zero_line[i / 64] && f->zero_line[i / 64 + 1];
+        int s = zero ? bpc_zero_size : bpcCompressData(((uint32_t *)(start + i)), bpctemp); // in bits
+        bpc_kind[i / 128] = zero ? BPC_ZERO : BPC_COMPRESSED;
+        if (COMPRESSION_NODE_NAME.sharedv->validate && !zero)
         {
             int s1 = bpcDecompressData(bpctemp, bpcrev);
             if (s1 != s)
@@ -43,15 +65,36 @@ static uint64_t bpc_compression(struct compression * c_p, uint8_t * start, uint1
                     return ERROR_SIZE;
                 }
         }
-        if (COMPRESSION_NODE_NAME.sharedv->parse_switch)
-            s = s > 1024 ? 1024: s;
+        if (COMPRESSION_NODE_NAME.sharedv->parse_switch && s >= 1024)
+        {
+            s = 1024;
+            bpc_kind[i / 128] = BPC_RAW;
+        }
         sum += s;
     }
+    bpc_page = start;
     return sum;
 }
 
+//a 64-byte line is decompressed with the other line of its 128-byte block
+static void bpc_decompression(struct compression * c_p, int line)
+{
+    int i = line < 0 ? 0 : line * CACHELINE_SIZE / 128;
+    int end = line < 0 ? PAGE_SIZE / 128 : ((line + 1) * CACHELINE_SIZE + 127) / 128;
+    for (; i < end; i++)
+        if (bpc_kind[i] == BPC_COMPRESSED)
+            bpcDecompressData(bpc_saved[i], bpc_out + i * 32);
+        else if (bpc_kind[i] == BPC_ZERO)
+            memset(bpc_out + i * 32, 0, 128);
+        else
+            memcpy(bpc_out + i * 32, bpc_page + i * 128, 128);
+}
+
 struct compression COMPRESSION_NODE_NAME = {
     .next = NULL,
     .name = "bpc",
-    .compress = (run_compression_t)bpc_compression
+    .compress = (run_compression_t)bpc_compression,
+    .decompress = (run_decompression_t)bpc_decompression,
+    .configure = (compression_configure_t)bpc_configure,
+    .cacheable = 1
 };
\ No newline at end of file
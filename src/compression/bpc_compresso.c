@@ -10,15 +10,33 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include <bpc_compresso.h>   //int16*32
 #include <plugin_struct.h>
 
 struct compression COMPRESSION_NODE_NAME;
 
-static uint64_t bpc_compresso_compression(struct compression * c_p, uint8_t * start, uint16_t ** report)
+enum bpc_compresso_line {BPC_COMPRESSO_COMPRESSED, BPC_COMPRESSO_ZERO, BPC_COMPRESSO_RAW};
+
+//last page compressed by this thread, kept for -D
+static __thread uint8_t bpc_compresso_saved[PAGE_SIZE / 64][34*2+2];
+static __thread uint8_t bpc_compresso_kind[PAGE_SIZE / 64];
+static __thread uint8_t * bpc_compresso_page;
+static __thread uint16_t bpc_compresso_out[PAGE_SIZE / 2];
+
+//size of a zero cacheline in bits, same for every page, computed once at load
+static int bpc_compresso_zero_size;
+
+static void bpc_compresso_configure(struct compression * c_p)
 {
+    uint16_t zero[32] = {0};
     uint8_t bpctemp[34*2+2];
+    bpc_compresso_zero_size = bpcCompressData(zero, bpctemp);
+}
+
+static uint64_t bpc_compresso_compression(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f)
+{
     uint16_t bpcrev[32];
     uint64_t i, cache_size = 0;
     uint64_t sum = 0;
@@ -27,8 +45,11 @@ static uint64_t bpc_compresso_compression(struct compression * c_p, uint8_t * st
     for (i = 0; i < PAGE_SIZE; i += 64)//cacheline size is fixed here for compression
     {
         int j;
-        int s = bpcCompressData(((uint16_t *)(start + i)), bpctemp); // in bits
-        if (COMPRESSION_NODE_NAME.sharedv->validate)
+        uint8_t * bpctemp = bpc_compresso_saved[i / 64];
+        int zero = CACHELINE_SIZE == 64 && f->zero_line[i / 64];   //skip zero lines found by driver
+        int s = zero ? bpc_compresso_zero_size : bpcCompressData(((uint16_t *)(start + i)), bpctemp); // in bits
+        bpc_compresso_kind[i / 64] = zero ? BPC_COMPRESSO_ZERO : BPC_COMPRESSO_COMPRESSED;
+        if (COMPRESSION_NODE_NAME.sharedv->validate && !zero)
         {
             int s1 = bpcDecompressData(bpctemp, bpcrev);
             if (s1 != s)
@@ -45,8 +66,11 @@ static uint64_t bpc_compresso_compression(struct compression * c_p, uint8_t * st
                     return ERROR_SIZE;
                 }
         }
-        if (COMPRESSION_NODE_NAME.sharedv->parse_switch)
-            s = s > 64 * 8 ? 64 * 8 : s;
+        if (COMPRESSION_NODE_NAME.sharedv->parse_switch && s >= 64 * 8)
+        {
+            s = 64 * 8;
+            bpc_compresso_kind[i / 64] = BPC_COMPRESSO_RAW;
+        }
         sum += s;
         cache_size += s;
         if (report != NULL && (i + 64) % CACHELINE_SIZE == 0)
@@ -55,11 +79,28 @@ static uint64_t bpc_compresso_compression(struct compression * c_p, uint8_t * st
             cache_size = 0;
         }
     }
+    bpc_compresso_page = start;
     return sum;
 }
 
+static void bpc_compresso_decompression(struct compression * c_p, int line)
+{
+    int i = line < 0 ? 0 : line * CACHELINE_SIZE / 64;
+    int end = line < 0 ? PAGE_SIZE / 64 : ((line + 1) * CACHELINE_SIZE + 63) / 64;
+    for (; i < end; i++)
+        if (bpc_compresso_kind[i] == BPC_COMPRESSO_COMPRESSED)
+            bpcDecompressData(bpc_compresso_saved[i], bpc_compresso_out + i * 32);
+        else if (bpc_compresso_kind[i] == BPC_COMPRESSO_ZERO)
+            memset(bpc_compresso_out + i * 32, 0, 64);
+        else
+            memcpy(bpc_compresso_out + i * 32, bpc_compresso_page + i * 64, 64);
+}
+
 struct compression COMPRESSION_NODE_NAME = {
     .next = NULL,
     .name = "bpc_compresso",    // int16*32
-    .compress = (run_compression_t)bpc_compresso_compression
+    .compress = (run_compression_t)bpc_compresso_compression,
+    .decompress = (run_decompression_t)bpc_compresso_decompression,
+    .configure = (compression_configure_t)bpc_compresso_configure,
+    .cacheable = 1
 };
\ No newline at end of file
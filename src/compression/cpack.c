@@ -10,15 +10,33 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include <cpack.h>
 #include <plugin_struct.h>
 
 struct compression COMPRESSION_NODE_NAME;
 
-static uint64_t cpack_compression(struct compression * c_p, uint8_t * start, uint16_t ** report)
+enum cpack_line {CPACK_COMPRESSED, CPACK_ZERO, CPACK_RAW};
+
+//last page compressed by this thread, kept for -D
+static __thread uint8_t cpack_saved[PAGE_SIZE / 64][68];
+static __thread uint8_t cpack_kind[PAGE_SIZE / 64];
+static __thread uint8_t * cpack_page;
+static __thread uint8_t cpack_out[PAGE_SIZE];
+
+//size of a zero cacheline in bits, same for every page, computed once at load
+static int cpack_zero_size;
+
+static void cpack_configure(struct compression * c_p)
 {
+    uint8_t zero[64] = {0};
     uint8_t cpacktemp[68];
+    cpack_zero_size = cpack_compress(zero, cpacktemp);
+}
+
+static uint64_t cpack_compression(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f)
+{
     uint8_t cpackrev[64];
     uint64_t i, cache_size = 0;
     if (CACHELINE_SIZE % 64 == 0) // aligned to multiple
@@ -26,9 +44,15 @@ static uint64_t cpack_compression(struct compression * c_p, uint8_t * start, uin
     uint64_t sum = 0;
     for (i = 0; i < PAGE_SIZE; i += 64)
     {
-        int s = cpack_compress(start + i, cpacktemp); // in bits, fixed cacheline size?
-        if (COMPRESSION_NODE_NAME.sharedv->parse_switch)
-            s = s > 64 * 8 ? 64 * 8 : s;
+        uint8_t * cpacktemp = cpack_saved[i / 64];
+        int zero = CACHELINE_SIZE == 64 && f->zero_line[i / 64];   //skip zero lines found by driver
+        int s = zero ? cpack_zero_size : cpack_compress(start + i, cpacktemp); // in bits, fixed cacheline size?
+        cpack_kind[i / 64] = zero ? CPACK_ZERO : CPACK_COMPRESSED;
+        if (COMPRESSION_NODE_NAME.sharedv->parse_switch && s >= 64 * 8)
+        {
+            s = 64 * 8;
+            cpack_kind[i / 64] = CPACK_RAW;
+        }
         cache_size += s;
         if (report != NULL && (i + 64) % CACHELINE_SIZE == 0)
         {
@@ -36,7 +60,7 @@ static uint64_t cpack_compression(struct compression * c_p, uint8_t * start, uin
             cache_size = 0;
         }
         sum += s;
-        if (COMPRESSION_NODE_NAME.sharedv->validate && !(s >= 64 * 8 && COMPRESSION_NODE_NAME.sharedv->parse_switch))
+        if (COMPRESSION_NODE_NAME.sharedv->validate && !zero && !(s >= 64 * 8 && COMPRESSION_NODE_NAME.sharedv->parse_switch))
         {
 			cpack_decompress(cpacktemp, cpackrev);
             int j;
@@ -48,11 +72,28 @@ static uint64_t cpack_compression(struct compression * c_p, uint8_t * start, uin
                 }
 		}
     }
+    cpack_page = start;
     return sum;
 }
 
+static void cpack_decompression(struct compression * c_p, int line)
+{
+    int i = line < 0 ? 0 : line * CACHELINE_SIZE / 64;
+    int end = line < 0 ? PAGE_SIZE / 64 : ((line + 1) * CACHELINE_SIZE + 63) / 64;
+    for (; i < end; i++)
+        if (cpack_kind[i] == CPACK_COMPRESSED)
+            cpack_decompress(cpack_saved[i], cpack_out + i * 64);
+        else if (cpack_kind[i] == CPACK_ZERO)
+            memset(cpack_out + i * 64, 0, 64);
+        else
+            memcpy(cpack_out + i * 64, cpack_page + i * 64, 64);
+}
+
 struct compression COMPRESSION_NODE_NAME = {
     .next = NULL,
     .name = "cpack",
-    .compress = (run_compression_t)cpack_compression
+    .compress = (run_compression_t)cpack_compression,
+    .decompress = (run_decompression_t)cpack_decompression,
+    .configure = (compression_configure_t)cpack_configure,
+    .cacheable = 1
 };
\ No newline at end of file
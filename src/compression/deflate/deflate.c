@@ -3,6 +3,19 @@
     Wrap code for deflate compression to run with program
     Used code from zlib to control zlib behavior
 
+    Streams are kept per thread and reset between pages. This is not measurably faster than
+    initializing a stream for every page, as deflateReset still clears the hash of memLevel 8.
+    Lower memLevels clear less but collide more on a 4KB page and are not faster either.
+    Each entry of deflate_variants is reported as its own compression.
+    -c "deflate.variants=level:window:strategy;..." adds variants, i.e. "1:12:;9:12:;:15:;:12:huff",
+    reported as deflate_l1_w12 and so on. Window is in bits, strategy is one of default, filtered,
+    huff, rle or fixed. An empty part keeps the setting of deflate.
+    -c deflate.dict=1 adds deflate_dict, which samples the dump before compressions start and
+    builds a preset dictionary of frequent chunks, then sets it on the stream for every page.
+    The dictionary needs the 32K window, so deflate_w15 is added with it as the baseline
+    without dictionary at the same window.
+    Output of deflate is kept per thread for -D, which inflates a page up to the end of the line.
+
     By Yuqing Liu
     HEAP Lab, Virginia Tech 
     Jun 2019
@@ -11,146 +24,400 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <string.h>
+#include <time.h>
 
 #include <zlib/zlib.h>
 #include <plugin_struct.h>
 
+#ifndef DEFLATE_DICT_SIZE
+    #define DEFLATE_DICT_SIZE (32 * 1024)   //in bytes, at most 32K (window of deflate)
+#endif
+#ifndef DEFLATE_DICT_PAGES
+    #define DEFLATE_DICT_PAGES (1024)       //pages sampled to build dictionary
+#endif
+#define DEFLATE_DICT_CHUNK (32)             //dictionary is made of aligned chunks of this size
+#define DEFLATE_DICT_HASH_BITS (18)
+#define DEFLATE_VARIANT_MAX (16)            //sets of deflate.variants
+
 struct compression COMPRESSION_NODE_NAME;
 
-//copied from zlib. modified
-int ZEXPORT compress4k (dest, destLen, source, sourceLen)
-    Bytef *dest;
-    uLongf *destLen;
-    const Bytef *source;
-    uLong sourceLen;
+struct deflate_variant
 {
-    z_stream stream;
-    int err;
-    const uInt max = (uInt)-1;
-    uLong left;
+    int level;
+    int window;     //window bits, negative for raw deflate (no header)
+    int strategy;
+    int dict;       //1 to set preset dictionary before each page
+};
 
-    left = *destLen;
-    *destLen = 0;
+//first entry is the original setting: no header and 4k window size. deflate.variants follow the fixed ones
+#define DEFLATE_VARIANT_FIXED (3)
+#define DEFLATE_VARIANT_COUNT (DEFLATE_VARIANT_FIXED + DEFLATE_VARIANT_MAX)
+static struct deflate_variant deflate_variants[DEFLATE_VARIANT_COUNT] = {
+    {Z_DEFAULT_COMPRESSION, -12, Z_DEFAULT_STRATEGY, 0},    //deflate
+    {Z_DEFAULT_COMPRESSION, -15, Z_DEFAULT_STRATEGY, 1},    //deflate_dict
+    {Z_DEFAULT_COMPRESSION, -15, Z_DEFAULT_STRATEGY, 0},    //deflate_w15
+};
+static int deflate_dict_enabled;
+static char deflate_variant_names[DEFLATE_VARIANT_MAX][32];
+static const char * deflate_strategy_names[] = {"default", "filtered", "huff", "rle", "fixed"};
 
-    stream.zalloc = (alloc_func)0;
-    stream.zfree = (free_func)0;
-    stream.opaque = (voidpf)0;
+//streams of this thread. Initialized on first use and freed in thread clean
+static __thread z_stream * deflate_streams[DEFLATE_VARIANT_COUNT];
+static __thread z_stream * inflate_stream;
 
-    //modified for no header and 4k window size
-    err = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -12, 8, Z_DEFAULT_STRATEGY);
+//preset dictionary, shared read only by all threads after init
+static uint8_t deflate_dict[DEFLATE_DICT_SIZE];
+static int deflate_dict_size;
+static uint64_t deflate_dict_build_ns;
+//time spent setting dictionary and compressing with it. per thread, merged in thread clean
+static __thread uint64_t deflate_thread_set_ns, deflate_thread_ns, deflate_thread_pages;
+static uint64_t deflate_set_ns, deflate_ns, deflate_pages;
+static pthread_mutex_t deflate_lock = PTHREAD_MUTEX_INITIALIZER;
 
-    if (err != Z_OK) return err;
+//last page compressed by deflate in this thread, kept for -D
+static __thread uint8_t deflate_saved[PAGE_SIZE * 6 / 5];
+static __thread uLongf deflate_saved_size;
+static __thread uint8_t deflate_out[PAGE_SIZE];
 
-    stream.next_out = dest;
-    stream.avail_out = 0;
-    stream.next_in = (z_const Bytef *)source;
-    stream.avail_in = 0;
+extern struct compression deflate_nodes[];
 
-    do {
-        if (stream.avail_out == 0) {
-            stream.avail_out = left > (uLong)max ? max : (uInt)left;
-            left -= stream.avail_out;
-        }
-        if (stream.avail_in == 0) {
-            stream.avail_in = sourceLen > (uLong)max ? max : (uInt)sourceLen;
-            sourceLen -= stream.avail_in;
-        }
-        err = deflate(&stream, sourceLen ? Z_NO_FLUSH : Z_FINISH);
-    } while (err == Z_OK);
+static int deflate_variant_index(struct compression * c_p)
+{
+    if (c_p != &COMPRESSION_NODE_NAME)
+        return c_p - deflate_nodes + 1;
+    return 0;
+}
 
-    *destLen = stream.total_out;
-    deflateEnd(&stream);
-    return err == Z_STREAM_END ? Z_OK : err;
+static uint64_t deflate_now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
 }
 
-int ZEXPORT uncompress4k (dest, destLen, source, sourceLen)
-    Bytef *dest;
-    uLongf *destLen;
-    const Bytef *source;
-    uLong *sourceLen;
+//returns stream of this thread for variant, NULL on error
+static z_stream * deflate_get_stream(int v)
 {
-    z_stream stream;
-    int err;
-    const uInt max = (uInt)-1;
-    uLong len, left;
-    Byte buf[1];    /* for detection of incomplete stream when *destLen == 0 */
-
-    len = *sourceLen;
-    if (*destLen) {
-        left = *destLen;
-        *destLen = 0;
-    }
-    else {
-        left = 1;
-        dest = buf;
+    z_stream * stream = deflate_streams[v];
+    if (stream != NULL)
+        return deflateReset(stream) == Z_OK ? stream : NULL;
+    stream = malloc(sizeof(z_stream));
+    stream->zalloc = (alloc_func)0;
+    stream->zfree = (free_func)0;
+    stream->opaque = (voidpf)0;
+    if (deflateInit2(stream, deflate_variants[v].level, Z_DEFLATED, deflate_variants[v].window, 8, deflate_variants[v].strategy) != Z_OK)
+    {
+        free(stream);
+        return NULL;
     }
+    deflate_streams[v] = stream;
+    return stream;
+}
 
-    stream.next_in = (z_const Bytef *)source;
-    stream.avail_in = 0;
-    stream.zalloc = (alloc_func)0;
-    stream.zfree = (free_func)0;
-    stream.opaque = (voidpf)0;
-
-    //modified for raw
-    err = inflateInit2(&stream, -12);
-
-    if (err != Z_OK) return err;
-
-    stream.next_out = dest;
-    stream.avail_out = 0;
-
-    do {
-        if (stream.avail_out == 0) {
-            stream.avail_out = left > (uLong)max ? max : (uInt)left;
-            left -= stream.avail_out;
-        }
-        if (stream.avail_in == 0) {
-            stream.avail_in = len > (uLong)max ? max : (uInt)len;
-            len -= stream.avail_in;
-        }
-        err = inflate(&stream, Z_NO_FLUSH);
-    } while (err == Z_OK);
+static z_stream * inflate_get_stream(int window)
+{
+    z_stream * stream = inflate_stream;
+    if (stream != NULL)
+        return inflateReset2(stream, window) == Z_OK ? stream : NULL;
+    stream = malloc(sizeof(z_stream));
+    stream->zalloc = (alloc_func)0;
+    stream->zfree = (free_func)0;
+    stream->opaque = (voidpf)0;
+    stream->next_in = Z_NULL;
+    stream->avail_in = 0;
+    if (inflateInit2(stream, window) != Z_OK)
+    {
+        free(stream);
+        return NULL;
+    }
+    inflate_stream = stream;
+    return stream;
+}
 
-    *sourceLen -= len + stream.avail_in;
-    if (dest != buf)
-        *destLen = stream.total_out;
-    else if (stream.total_out && err == Z_BUF_ERROR)
-        left = 1;
+//copied from zlib. modified to run on a reset stream with a single call
+static int compress4k(z_stream * stream, Bytef * dest, uLongf * destLen, const Bytef * source, uLong sourceLen)
+{
+    int err;
+    stream->next_out = dest;
+    stream->avail_out = (uInt)*destLen;
+    stream->next_in = (z_const Bytef *)source;
+    stream->avail_in = (uInt)sourceLen;
+    err = deflate(stream, Z_FINISH);
+    *destLen = stream->total_out;
+    return err == Z_STREAM_END ? Z_OK : err == Z_OK ? Z_BUF_ERROR : err;
+}
 
-    inflateEnd(&stream);
+static int uncompress4k(z_stream * stream, Bytef * dest, uLongf * destLen, const Bytef * source, uLong sourceLen)
+{
+    int err;
+    stream->next_out = dest;
+    stream->avail_out = (uInt)*destLen;
+    stream->next_in = (z_const Bytef *)source;
+    stream->avail_in = (uInt)sourceLen;
+    err = inflate(stream, Z_FINISH);
+    *destLen = stream->total_out;
     return err == Z_STREAM_END ? Z_OK :
-           err == Z_NEED_DICT ? Z_DATA_ERROR  :
-           err == Z_BUF_ERROR && left + stream.avail_out ? Z_DATA_ERROR :
+           err == Z_NEED_DICT ? Z_DATA_ERROR :
+           err == Z_BUF_ERROR || err == Z_OK ? Z_DATA_ERROR :
            err;
 }
 
-static uint64_t deflate_method(struct compression * c_p, uint8_t * start, uint16_t ** report)
+//compresses block of length to compressed of 1.2 pages, length is at most a page. Compressed size is written to csize
+static uint64_t deflate_buffer(struct compression * c_p, uint8_t * start, int length, uint8_t * compressed, uLongf * csize)
 {
-    uint8_t compressed[(int)(1.2*PAGE_SIZE)];
+    int v = deflate_variant_index(c_p);
+    z_stream * stream = deflate_get_stream(v);
+    if (stream == NULL)
+    {
+        printf("Deflate Error: cannot initialize stream\n");
+        return ERROR_SIZE;
+    }
     uLongf size = (int)(1.2*PAGE_SIZE);
-    compress4k(compressed, &size, start, PAGE_SIZE);
-    uint64_t ret = 0;
-    ret = size * 8;
-    if (compression_node.sharedv->validate)
+    uint64_t t = 0, t_set = 0;
+    if (deflate_variants[v].dict)
+    {
+        t = deflate_now();
+        if (deflateSetDictionary(stream, deflate_dict, deflate_dict_size) != Z_OK)
+        {
+            printf("Deflate Error: cannot set dictionary\n");
+            return ERROR_SIZE;
+        }
+        t_set = deflate_now();
+    }
+    if (compress4k(stream, compressed, &size, start, length) != Z_OK)
+    {
+        printf("Deflate Error: compression failed\n");
+        return ERROR_SIZE;
+    }
+    if (deflate_variants[v].dict)
+    {
+        deflate_thread_set_ns += t_set - t;
+        deflate_thread_ns += deflate_now() - t;
+        deflate_thread_pages++;
+    }
+    uint64_t ret = size * 8;
+    *csize = size;
+    if (c_p->sharedv->validate)
     {
         uint8_t decompressed[PAGE_SIZE];
-        uLongf size2 = (int)(1.2*PAGE_SIZE);
-        uLong size3 = size;
-        uncompress4k(decompressed, &size2, compressed, &size3);
-        if (size2 != PAGE_SIZE)
-            printf("Defalte Error: size=%d!=PAGE_SIZE\n", size2);
-        for (size2 = 0; size2 < PAGE_SIZE; size2++)
+        uLongf size2 = length;
+        stream = inflate_get_stream(deflate_variants[v].window);
+        if (stream != NULL && deflate_variants[v].dict && inflateSetDictionary(stream, deflate_dict, deflate_dict_size) != Z_OK)
+            stream = NULL;
+        if (stream == NULL || uncompress4k(stream, decompressed, &size2, compressed, size) != Z_OK)
+        {
+            printf("Deflate Error: decompression failed\n");
+            return ERROR_SIZE;
+        }
+        if (size2 != length)
+            printf("Deflate Error: size=%lu!=%d\n", size2, length);
+        for (size2 = 0; size2 < length; size2++)
             if (start[size2] != decompressed[size2])
             {
-                printf("Defalte Error: offset=%d\n", size2);
+                printf("Deflate Error: offset=%lu\n", size2);
                 return ERROR_SIZE;
             }
     }
     return ret;
 }
 
+static uint64_t deflate_block(struct compression * c_p, uint8_t * start, int length)
+{
+    uint8_t compressed[(int)(1.2*PAGE_SIZE)];
+    uLongf size;
+    return deflate_buffer(c_p, start, length, compressed, &size);
+}
+
+static uint64_t deflate_method(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f)
+{
+    if (c_p == &COMPRESSION_NODE_NAME)
+        return deflate_buffer(c_p, start, PAGE_SIZE, deflate_saved, &deflate_saved_size);
+    return deflate_block(c_p, start, PAGE_SIZE);
+}
+
+//output stops at the end of line, so inflate does not reach the end of stream
+static void deflate_decompression(struct compression * c_p, int line)
+{
+    uLongf size = line < 0 ? PAGE_SIZE : (line + 1) * CACHELINE_SIZE;
+    z_stream * stream = inflate_get_stream(deflate_variants[0].window);
+    if (stream != NULL)
+        uncompress4k(stream, deflate_out, &size, deflate_saved, deflate_saved_size);
+}
+
+/*
+    Links deflate_dict and deflate_w15 if deflate.dict is set, then parses deflate.variants
+    and links a node for each set. Sets out of range are reported and left out
+*/
+static void deflate_configure(struct compression * c_p)
+{
+    char * sets[DEFLATE_VARIANT_MAX], * part;
+    int count = shared_variants(c_p->sharedv, "deflate.variants", sets, DEFLATE_VARIANT_MAX);
+    int i, j, n = 0;
+    struct compression * tail = c_p;
+    part = shared_config(c_p->sharedv, "deflate.dict");
+    deflate_dict_enabled = part != NULL && strtol(part, NULL, 0) != 0;
+    if (deflate_dict_enabled)
+    {
+        tail->next = &deflate_nodes[0];
+        tail = tail->next->next = &deflate_nodes[1];
+    }
+    for (i = 0; i < count; i++)
+    {
+        struct deflate_variant * v = &deflate_variants[DEFLATE_VARIANT_FIXED + n];
+        *v = deflate_variants[0];
+        part = sets[i];
+        if (*part != ':' && *part != '\0')
+            v->level = strtol(part, NULL, 0);
+        if ((part = strchr(part, ':')) != NULL && *++part != ':' && *part != '\0')
+            v->window = -strtol(part, NULL, 0);
+        if (part != NULL && (part = strchr(part, ':')) != NULL && *++part != '\0')
+        {
+            for (j = 0; j <= Z_FIXED && strcmp(part, deflate_strategy_names[j]); j++);
+            v->strategy = j;
+        }
+        if (v->level < Z_DEFAULT_COMPRESSION || v->level > 9 || v->window < -15 || v->window > -9 || v->strategy > Z_FIXED)
+        {
+            printf("deflate.variants:set %s is out of range\n", sets[i]);
+            continue;
+        }
+        snprintf(deflate_variant_names[n], sizeof(deflate_variant_names[0]), "deflate_l%d_w%d%s%s",
+            v->level == Z_DEFAULT_COMPRESSION ? 6 : v->level, -v->window,
+            v->strategy ? "_" : "", v->strategy ? deflate_strategy_names[v->strategy] : "");
+        deflate_nodes[DEFLATE_VARIANT_FIXED - 1 + n] = (struct compression){
+            .name = deflate_variant_names[n],
+            .compress = (run_compression_t)deflate_method,
+            .compress_block = (run_block_compression_t)deflate_block,
+            .prefilter = 1,
+            .cacheable = 1
+        };
+        tail = tail->next = &deflate_nodes[DEFLATE_VARIANT_FIXED - 1 + n];
+        n++;
+    }
+    tail->next = NULL;
+    if (count)
+        free(sets[0]);
+}
+
+struct deflate_chunk
+{
+    uint8_t * data;
+    uint32_t count;
+};
+
+static int deflate_chunk_cmp(const void * a, const void * b)
+{
+    uint32_t ca = ((struct deflate_chunk *)a)->count, cb = ((struct deflate_chunk *)b)->count;
+    return ca < cb ? -1 : ca > cb;
+}
+
+/*
+    Builds the preset dictionary from DEFLATE_DICT_PAGES pages evenly spaced across dump.
+    Aligned chunks are counted in a hash table, and the most frequent chunks fill the dictionary.
+    Chunks are placed by ascending count so the most frequent ones are the closest to the page.
+*/
+static void deflate_init(struct compression * c_p, uint8_t * dump, uint64_t size)
+{
+    if (!deflate_dict_enabled)
+        return;
+    uint64_t t = deflate_now();
+    uint64_t pages = size / PAGE_SIZE;
+    uint64_t stride = pages > DEFLATE_DICT_PAGES ? pages / DEFLATE_DICT_PAGES : 1;
+    uint64_t mask = (1 << DEFLATE_DICT_HASH_BITS) - 1;
+    struct deflate_chunk * table = calloc(mask + 1, sizeof(struct deflate_chunk));
+    uint64_t i, used = 0;
+    int j;
+    for (i = 0; i < pages && used < mask / 2; i += stride)
+        for (j = 0; j < PAGE_SIZE; j += DEFLATE_DICT_CHUNK)
+        {
+            uint8_t * chunk = dump + i * PAGE_SIZE + j;
+            uint64_t * w = (uint64_t *)chunk;
+            uint64_t h = 0;
+            int k;
+            for (k = 0; k < DEFLATE_DICT_CHUNK / 8; k++)
+                h = (h ^ w[k]) * 0x9E3779B97F4A7C15ull;
+            if (h == 0 || (w[0] == 0 && !memcmp(chunk, chunk + 1, DEFLATE_DICT_CHUNK - 1)))
+                continue;   //zero chunks are left to zero pages and lines
+            for (h >>= 64 - DEFLATE_DICT_HASH_BITS; table[h].data != NULL; h = (h + 1) & mask)
+                if (!memcmp(table[h].data, chunk, DEFLATE_DICT_CHUNK))
+                    break;
+            if (table[h].data == NULL)
+            {
+                table[h].data = chunk;
+                used++;
+            }
+            table[h].count++;
+        }
+    //move used entries to front and keep the most frequent
+    for (i = 0, used = 0; i <= mask; i++)
+        if (table[i].data != NULL)
+            table[used++] = table[i];
+    qsort(table, used, sizeof(struct deflate_chunk), deflate_chunk_cmp);
+    i = used > DEFLATE_DICT_SIZE / DEFLATE_DICT_CHUNK ? used - DEFLATE_DICT_SIZE / DEFLATE_DICT_CHUNK : 0;
+    for (; i < used; i++)
+    {
+        memcpy(deflate_dict + deflate_dict_size, table[i].data, DEFLATE_DICT_CHUNK);
+        deflate_dict_size += DEFLATE_DICT_CHUNK;
+    }
+    free(table);
+    deflate_dict_build_ns = deflate_now() - t;
+}
+
+//Frees streams of this thread. Called once per thread, by the first variant only
+static void deflate_thread_clean(struct compression * c_p)
+{
+    int i;
+    pthread_mutex_lock(&deflate_lock);
+    deflate_set_ns += deflate_thread_set_ns;
+    deflate_ns += deflate_thread_ns;
+    deflate_pages += deflate_thread_pages;
+    pthread_mutex_unlock(&deflate_lock);
+    deflate_thread_set_ns = deflate_thread_ns = deflate_thread_pages = 0;
+    for (i = 0; i < DEFLATE_VARIANT_COUNT; i++)
+        if (deflate_streams[i] != NULL)
+        {
+            deflateEnd(deflate_streams[i]);
+            free(deflate_streams[i]);
+            deflate_streams[i] = NULL;
+        }
+    if (inflate_stream != NULL)
+    {
+        inflateEnd(inflate_stream);
+        free(inflate_stream);
+        inflate_stream = NULL;
+    }
+}
+
+/*
+    Prints dictionary cost. Build time is amortized over pages compressed with the dictionary,
+    and setting dictionary is part of the per-page time.
+*/
+static void deflate_clean(struct compression * c_p)
+{
+    if (deflate_dict_enabled)
+        printf("deflate dictionary:%d bytes:build %lfms(%lfns per page):set %lfns per page:compress with set %lfns per page\n",
+            deflate_dict_size, deflate_dict_build_ns / 1000000.0,
+            deflate_pages ? deflate_dict_build_ns / (double)deflate_pages : 0,
+            deflate_pages ? deflate_set_ns / (double)deflate_pages : 0,
+            deflate_pages ? deflate_ns / (double)deflate_pages : 0);
+}
+
+//deflate_dict, deflate_w15, then a node for each set of deflate.variants, linked by deflate_configure
+struct compression deflate_nodes[DEFLATE_VARIANT_COUNT - 1] = {
+    {.name = "deflate_dict", .compress = (run_compression_t)deflate_method, .prefilter = 1},
+    {.name = "deflate_w15", .compress = (run_compression_t)deflate_method, .compress_block = (run_block_compression_t)deflate_block, .prefilter = 1, .cacheable = 1},
+};
+
 struct compression COMPRESSION_NODE_NAME = {
     .next = NULL,
     .name = "deflate",
     .compress = (run_compression_t)deflate_method,
+    .compress_block = (run_block_compression_t)deflate_block,
+    .decompress = (run_decompression_t)deflate_decompression,
+    .thread_clean = (compression_thread_clean_t)deflate_thread_clean,
+    .init = (compression_init_t)deflate_init,
+    .clean = (compression_clean_t)deflate_clean,
+    .configure = (compression_configure_t)deflate_configure,
+    .prefilter = 1,
+    .cacheable = 1
 };
@@ -1,6 +1,8 @@
 /*
 
     Wrap code for huffman compression to run with program
+    Compressed data is only produced for validation and -D
+    For -D the code of the page is read once when it is compressed, so only decoding is timed
 
     By Yuqing Liu
     HEAP Lab, Virginia Tech 
@@ -16,18 +18,32 @@
 
 struct compression COMPRESSION_NODE_NAME;
 
-static uint64_t huff1_compression(struct compression * c_p, uint8_t * start, uint16_t ** report)
+//last page compressed by this thread, kept for -D. Pages not smaller than raw under -p are kept raw
+static __thread uint8_t huff1_saved[5000];
+static __thread int huff1_raw;
+static __thread uint8_t * huff1_page;
+static __thread uint8_t huff1_out[PAGE_SIZE];
+static __thread struct huff_decoder huff1_decoder;
+
+//compresses block of length with byte histogram, or NULL if unknown. Compressed data is written to dest if not NULL
+static uint64_t huff1_encode(uint8_t * start, int length, uint32_t * histogram, uint8_t * dest)
 {
+    if (!COMPRESSION_NODE_NAME.sharedv->validate && dest == NULL)
+        return Huffman1_encode(start, NULL, length, histogram) * 8;
     uint8_t comp[5000] = {0};
-    uint64_t res = Huffman1_encode(start, comp, 4096);
-    if (COMPRESSION_NODE_NAME.sharedv->validate && !(res >= 4096 && COMPRESSION_NODE_NAME.sharedv->parse_switch))
+    if (dest == NULL)
+        dest = comp;
+    uint64_t res = Huffman1_encode(start, dest, length, histogram);
+    if (!COMPRESSION_NODE_NAME.sharedv->validate)
+        return res * 8;
+    if (!(res >= length && COMPRESSION_NODE_NAME.sharedv->parse_switch))
     {
         uint8_t rev[5000] = {0};
-        uint64_t res1 = Huffman1_decode(comp, rev, 4096);
+        uint64_t res1 = Huffman1_decode(dest, rev, length);
         if (res != res1)
             printf("huffman1 Error: sizet=%"PRId64" != %"PRId64"\n", res, res1);
         int i;
-        for (i = 0; i < 4096; i++)
+        for (i = 0; i < length; i++)
         {
             if (rev[i]!=start[i])
             {
@@ -39,8 +55,40 @@ static uint64_t huff1_compression(struct compression * c_p, uint8_t * start, uin
     return res * 8;
 }
 
+static uint64_t huff1_block(struct compression * c_p, uint8_t * start, int length)
+{
+    return huff1_encode(start, length, NULL, NULL);
+}
+
+//byte histogram is taken from driver
+static uint64_t huff1_compression(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f)
+{
+    if (!c_p->sharedv->decompress_repeat)
+        return huff1_encode(start, 4096, f->histogram, NULL);
+    uint64_t res = huff1_encode(start, 4096, f->histogram, huff1_saved);
+    huff1_raw = res >= 4096 * 8 && c_p->sharedv->parse_switch;
+    huff1_page = start;
+    if (!huff1_raw)
+        Huffman1_decode_init(huff1_saved, &huff1_decoder);
+    return res;
+}
+
+//whole page is decoded up to the end of line
+static void huff1_decompression(struct compression * c_p, int line)
+{
+    int size = line < 0 ? PAGE_SIZE : (line + 1) * CACHELINE_SIZE;
+    if (huff1_raw)
+        memcpy(huff1_out, huff1_page, size);
+    else
+        Huffman1_decode_with(&huff1_decoder, huff1_saved, huff1_out, size);
+}
+
 struct compression COMPRESSION_NODE_NAME = {
     .next = NULL,
     .name = "huffman1",
-    .compress = (run_compression_t)huff1_compression
-};
\ No newline at end of file
+    .compress = (run_compression_t)huff1_compression,
+    .compress_block = (run_block_compression_t)huff1_block,
+    .decompress = (run_decompression_t)huff1_decompression,
+    .prefilter = 1,
+    .cacheable = 1
+};
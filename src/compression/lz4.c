@@ -2,43 +2,261 @@
 
     Wrap code for lz4 compression to run with program
 
-    HEAP Lab, Virginia Tech 
+    Streams are kept per thread and reused between pages.
+    lz4_dict_prev uses the previous LZ4_DICT_PREV_SIZE bytes of the thread slice as dictionary.
+    Its stream runs over the slice, so after a page right before is compressed the dictionary
+    is already in place and only needs to be cut to size.
+    lz4_dict_static uses a dictionary of LZ4_DICT_STATIC_SIZE bytes sampled across the dump at start,
+    loaded once per thread and copied to the stream of each page.
+    With -c lz4.throughput=1, compression of each mode is timed and its throughput is printed in the end.
+    Output of lz4 is kept per thread for -D, which decompresses a page up to the end of the line.
+
+    HEAP Lab, Virginia Tech
     Aug 2019
 */
 
 #include <stdio.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <time.h>
 
 #include <lz4/lz42.h>
 #include <plugin_struct.h>
 
+#ifndef LZ4_DICT_PREV_SIZE
+    #define LZ4_DICT_PREV_SIZE (4 * 1024)       //in bytes, at most 64K
+#endif
+#ifndef LZ4_DICT_STATIC_SIZE
+    #define LZ4_DICT_STATIC_SIZE (16 * 1024)    //in bytes, at most 64K
+#endif
+#define LZ4_DICT_SAMPLE_SIZE (256)              //static dictionary is made of pieces of this size
+
 struct compression COMPRESSION_NODE_NAME;
+extern struct compression lz4_dict_nodes[];
+
+enum lz4_mode {LZ4_PAGE, LZ4_DICT_PREV, LZ4_DICT_STATIC, LZ4_MODE_COUNT};
+
+//streams of this thread. Initialized on first use and freed in thread clean
+static __thread LZ4_stream_t * lz4_stream;
+static __thread LZ4_stream_t * lz4_prev_stream;
+static __thread LZ4_stream_t * lz4_static_stream;
+
+//dictionary of lz4_prev_stream is cut to this, and the page it follows
+static __thread char lz4_prev_dict[LZ4_DICT_PREV_SIZE];
+static __thread uint8_t * lz4_prev_end;
+
+//-c lz4.throughput, time compressions and print throughput
+static int lz4_throughput;
+
+//time spent compressing by this thread, merged to totals in thread clean
+static __thread uint64_t lz4_thread_ns[LZ4_MODE_COUNT];
+static __thread uint64_t lz4_thread_pages[LZ4_MODE_COUNT];
+static uint64_t lz4_ns[LZ4_MODE_COUNT];
+static uint64_t lz4_pages[LZ4_MODE_COUNT];
+static pthread_mutex_t lz4_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//static dictionary, shared read only by all threads after init. Each thread loads its own copy
+static char lz4_static_dict[LZ4_DICT_STATIC_SIZE];
+static int lz4_static_dict_size;
+static uint64_t lz4_static_ns;
+static __thread LZ4_stream_t * lz4_static_loaded;
+
+//last page compressed by lz4 in this thread, kept for -D
+static __thread char lz4_saved[PAGE_SIZE * 6 / 5];
+static __thread int lz4_saved_size;
+static __thread char lz4_out[PAGE_SIZE];
+
+static uint64_t lz4_now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static LZ4_stream_t * lz4_get_stream(LZ4_stream_t ** stream)
+{
+    if (*stream == NULL)
+        *stream = LZ4_createStream();
+    return *stream;
+}
+
+//checks compressed against start. dict can be NULL
+static int lz4_validate(uint8_t * start, int length, char * compressed, int csize, char * dict, int dict_size)
+{
+    uint8_t decompressed[PAGE_SIZE];
+    int size = LZ4_decompress_safe_usingDict(compressed, (char *)decompressed, csize, length, dict, dict_size);
+    if (size != length)
+        printf("Lz4 Error: size=%d!=%d\n", size, length);
+    for (size = 0; size < length; size++)
+        if (start[size] != decompressed[size])
+        {
+            printf("Lz4 Error: offset=%d\n", size);
+            return 0;
+        }
+    return 1;
+}
+
+//compresses block of length, length is at most a page
+static uint64_t lz4_block(struct compression * c_p, uint8_t * start, int length)
+{
+    char compressed[(int)(PAGE_SIZE * 1.2)];
+    LZ4_stream_t * stream = lz4_get_stream(&lz4_stream);
+    int csize = LZ4_compress_fast_extState_fastReset(stream, (const char *)start, compressed, length, sizeof(compressed), 1);
+    if (COMPRESSION_NODE_NAME.sharedv->validate && !lz4_validate(start, length, compressed, csize, NULL, 0))
+        return ERROR_SIZE;
+    return csize * 8;
+}
+
+static uint64_t lz4_compression(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f)
+{
+    uint64_t t = lz4_throughput ? lz4_now() : 0;
+    LZ4_stream_t * stream = lz4_get_stream(&lz4_stream);
+    int csize = LZ4_compress_fast_extState_fastReset(stream, (const char *)start, lz4_saved, PAGE_SIZE, sizeof(lz4_saved), 1);
+    if (lz4_throughput)
+        lz4_thread_ns[LZ4_PAGE] += lz4_now() - t;
+    lz4_thread_pages[LZ4_PAGE]++;
+    lz4_saved_size = csize;
+    if (c_p->sharedv->validate && !lz4_validate(start, PAGE_SIZE, lz4_saved, csize, NULL, 0))
+        return ERROR_SIZE;
+    return csize * 8;
+}
 
-static uint64_t lz4_compression(struct compression * c_p, uint8_t * start, uint16_t ** report)
+static void lz4_decompression(struct compression * c_p, int line)
 {
-    uint8_t compressed[(int)(PAGE_SIZE * 1.2)];
-    int size = PAGE_SIZE*1.2;
-    int csize = LZ4_compress_default((const char *)start, (char *)compressed, PAGE_SIZE, size);
-    if (COMPRESSION_NODE_NAME.sharedv->validate)
+    int size = line < 0 ? PAGE_SIZE : (line + 1) * CACHELINE_SIZE;
+    LZ4_decompress_safe_partial(lz4_saved, lz4_out, lz4_saved_size, size, PAGE_SIZE);
+}
+
+static uint64_t lz4_dict_compression(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f)
+{
+    char compressed[(int)(PAGE_SIZE * 1.2)];
+    int mode = c_p - lz4_dict_nodes + LZ4_DICT_PREV;
+    char * dict;
+    int dict_size, csize;
+    uint64_t t = lz4_throughput ? lz4_now() : 0;
+    if (mode == LZ4_DICT_PREV)
     {
-        uint8_t decompressed[PAGE_SIZE];
-        size = PAGE_SIZE;
-        size = LZ4_decompress_safe((const char *)compressed, (char *)decompressed, csize, size);
-        if (size != PAGE_SIZE)
-            printf("Lz4 Error: size=%d!=page\n", size);
-        for (size = 0; size < PAGE_SIZE; size++)
-            if (start[size] != decompressed[size])
-            {
-                printf("Lz4 Error: offset=%d\n", size);
-                return ERROR_SIZE;
-            }
+        LZ4_stream_t * stream = lz4_get_stream(&lz4_prev_stream);
+        dict_size = f->history < LZ4_DICT_PREV_SIZE ? f->history : LZ4_DICT_PREV_SIZE;
+        dict = (char *)start - dict_size;
+        //the stream holds the page before unless a page of the slice was not compressed, i.e. zero
+        if (LZ4_DICT_PREV_SIZE > PAGE_SIZE || start != lz4_prev_end || dict_size < LZ4_DICT_PREV_SIZE)
+            LZ4_loadDict(stream, dict, dict_size);
+        csize = LZ4_compress_fast_continue(stream, (const char *)start, compressed, PAGE_SIZE, sizeof(compressed), 1);
+        LZ4_saveDict(stream, lz4_prev_dict, LZ4_DICT_PREV_SIZE);
+        lz4_prev_end = start + PAGE_SIZE;
     }
+    else
+    {
+        LZ4_stream_t * stream = lz4_get_stream(&lz4_static_stream);
+        if (lz4_static_loaded == NULL)
+        {
+            lz4_static_loaded = LZ4_createStream();
+            LZ4_loadDict(lz4_static_loaded, lz4_static_dict, lz4_static_dict_size);
+        }
+        dict = lz4_static_dict;
+        dict_size = lz4_static_dict_size;
+        //copied rather than attached, a 4KB page is compressed faster looking up one table
+        memcpy(stream, lz4_static_loaded, sizeof(LZ4_stream_t));
+        csize = LZ4_compress_fast_continue(stream, (const char *)start, compressed, PAGE_SIZE, sizeof(compressed), 1);
+    }
+    if (lz4_throughput)
+        lz4_thread_ns[mode] += lz4_now() - t;
+    lz4_thread_pages[mode]++;
+    if (c_p->sharedv->validate && !lz4_validate(start, PAGE_SIZE, compressed, csize, dict, dict_size))
+        return ERROR_SIZE;
     return csize * 8;
 }
 
+static void lz4_configure(struct compression * c_p)
+{
+    char * v = shared_config(c_p->sharedv, "lz4.throughput");
+    lz4_throughput = v != NULL && strtol(v, NULL, 0) != 0;
+}
+
+/*
+    Samples the static dictionary from pieces evenly spaced across dump.
+    Pieces filled with zero are passed over, the driver measures zero pages on its own.
+*/
+static void lz4_init(struct compression * c_p, uint8_t * dump, uint64_t size)
+{
+    uint64_t t = lz4_now();
+    uint64_t count = LZ4_DICT_STATIC_SIZE / LZ4_DICT_SAMPLE_SIZE;
+    uint64_t stride = (size / count) & ~(uint64_t)(LZ4_DICT_SAMPLE_SIZE - 1);
+    uint64_t i, off;
+    if (stride < LZ4_DICT_SAMPLE_SIZE)
+        stride = LZ4_DICT_SAMPLE_SIZE;
+    for (i = 0; i < count && i * stride < size; i++)
+        for (off = i * stride; off < (i + 1) * stride && off + LZ4_DICT_SAMPLE_SIZE <= size; off += LZ4_DICT_SAMPLE_SIZE)
+        {
+            int j;
+            for (j = 0; j < LZ4_DICT_SAMPLE_SIZE && dump[off + j] == 0; j++);
+            if (j == LZ4_DICT_SAMPLE_SIZE)
+                continue;
+            memcpy(lz4_static_dict + lz4_static_dict_size, dump + off, LZ4_DICT_SAMPLE_SIZE);
+            lz4_static_dict_size += LZ4_DICT_SAMPLE_SIZE;
+            break;
+        }
+    lz4_static_ns = lz4_now() - t;
+}
+
+//Frees streams of this thread. Called once per thread, by the first node only
+static void lz4_thread_clean(struct compression * c_p)
+{
+    int i;
+    pthread_mutex_lock(&lz4_lock);
+    for (i = 0; i < LZ4_MODE_COUNT; i++)
+    {
+        lz4_ns[i] += lz4_thread_ns[i];
+        lz4_pages[i] += lz4_thread_pages[i];
+        lz4_thread_ns[i] = 0;
+        lz4_thread_pages[i] = 0;
+    }
+    pthread_mutex_unlock(&lz4_lock);
+    if (lz4_stream != NULL)
+        LZ4_freeStream(lz4_stream);
+    if (lz4_prev_stream != NULL)
+        LZ4_freeStream(lz4_prev_stream);
+    if (lz4_static_stream != NULL)
+        LZ4_freeStream(lz4_static_stream);
+    if (lz4_static_loaded != NULL)
+        LZ4_freeStream(lz4_static_loaded);
+    lz4_stream = NULL;
+    lz4_prev_stream = NULL;
+    lz4_static_stream = NULL;
+    lz4_static_loaded = NULL;
+    lz4_prev_end = NULL;
+}
+
+//prints throughput of each mode in MB/s of one thread with lz4.throughput, from time summed over threads
+static void lz4_clean(struct compression * c_p)
+{
+    int i;
+    if (lz4_throughput)
+    {
+        printf("lz4 throughput(MB/s per thread):");
+        for (i = 0; i < LZ4_MODE_COUNT; i++)
+            printf("%s=%lf:", i ? lz4_dict_nodes[i - 1].name : c_p->name, lz4_ns[i] ? lz4_pages[i] * PAGE_SIZE * 1000.0 / lz4_ns[i] : 0);
+        printf("\n");
+    }
+    printf("lz4 static dictionary:%d bytes sampled in %lfms\n", lz4_static_dict_size, lz4_static_ns / 1000000.0);
+}
+
+struct compression lz4_dict_nodes[] = {
+    {.next = &lz4_dict_nodes[1], .name = "lz4_dict_prev", .compress = (run_compression_t)lz4_dict_compression, .prefilter = 1},
+    {.next = NULL, .name = "lz4_dict_static", .compress = (run_compression_t)lz4_dict_compression, .prefilter = 1},
+};
+
 struct compression COMPRESSION_NODE_NAME = {
-    .next = NULL,
+    .next = lz4_dict_nodes,
     .name = "lz4",
-    .compress = (run_compression_t)lz4_compression
+    .compress = (run_compression_t)lz4_compression,
+    .compress_block = (run_block_compression_t)lz4_block,
+    .decompress = (run_decompression_t)lz4_decompression,
+    .thread_clean = (compression_thread_clean_t)lz4_thread_clean,
+    .init = (compression_init_t)lz4_init,
+    .configure = (compression_configure_t)lz4_configure,
+    .clean = (compression_clean_t)lz4_clean,
+    .prefilter = 1,
+    .cacheable = 1
 };
@@ -0,0 +1,228 @@
+/*
+
+    Wrap code for SC2 compression to run with program
+
+    Two passes. Pre-pass counts 32-bit words of sampled pages in per-thread tables,
+    which are merged when the sampling threads exit. The global code is built in init
+    from the most frequent values and every cacheline is encoded with it.
+    Tables keep the most frequent values approximately by halving counts when full,
+    like the value frequency table of SC2.
+
+    HEAP Lab, Virginia Tech
+    Oct 2019
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <sc2.h>
+#include <plugin_struct.h>
+
+#define SC2_LOCAL_BITS (16)     //per-thread sample table
+#define SC2_GLOBAL_BITS (20)    //merged sample table
+
+struct compression COMPRESSION_NODE_NAME;
+
+struct sc2_count
+{
+    uint32_t value;
+    uint64_t count;             //0 if empty
+};
+
+struct sc2_table
+{
+    struct sc2_count * entry;
+    int bits;
+    uint64_t used;
+};
+
+static __thread struct sc2_table sc2_local;
+static struct sc2_table sc2_global;
+static pthread_mutex_t sc2_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t sc2_words, sc2_pages;
+static __thread uint64_t sc2_local_words, sc2_local_pages;
+
+static struct sc2_code sc2_code;
+static int sc2_zero_line;       //size of a zero cacheline in bits
+static uint64_t sc2_build_ns;
+
+static uint64_t sc2_now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static void sc2_table_insert(struct sc2_table * t, uint32_t v, uint64_t count);
+
+//halves all counts and drops values that reach 0
+static void sc2_table_decay(struct sc2_table * t)
+{
+    uint64_t i, size = 1ull << t->bits;
+    struct sc2_count * old = t->entry;
+    t->entry = calloc(size, sizeof(struct sc2_count));
+    t->used = 0;
+    for (i = 0; i < size; i++)
+        if (old[i].count > 1)
+            sc2_table_insert(t, old[i].value, old[i].count / 2);
+    free(old);
+}
+
+static void sc2_table_insert(struct sc2_table * t, uint32_t v, uint64_t count)
+{
+    uint64_t mask = (1ull << t->bits) - 1;
+    uint64_t h;
+    for (h = (v * 0x9E3779B97F4A7C15ull) >> (64 - t->bits); t->entry[h].count != 0; h = (h + 1) & mask)
+        if (t->entry[h].value == v)
+        {
+            t->entry[h].count += count;
+            return;
+        }
+    if (t->used >= mask / 4 * 3)
+    {
+        sc2_table_decay(t);
+        sc2_table_insert(t, v, count);
+        return;
+    }
+    t->entry[h].value = v;
+    t->entry[h].count = count;
+    t->used++;
+}
+
+static void sc2_sample(struct compression * c_p, uint8_t * start, struct page_features * f)
+{
+    uint32_t * words = (uint32_t *)start;
+    int i, j;
+    if (sc2_local.entry == NULL)
+    {
+        sc2_local.bits = SC2_LOCAL_BITS;
+        sc2_local.entry = calloc(1ull << SC2_LOCAL_BITS, sizeof(struct sc2_count));
+    }
+    for (i = 0; i < PAGE_SIZE / 64; i++)
+    {
+        if (CACHELINE_SIZE == 64 && f->zero_line[i])
+        {
+            sc2_table_insert(&sc2_local, 0, SC2_LINE_WORDS);
+            continue;
+        }
+        for (j = 0; j < SC2_LINE_WORDS; j++)
+            sc2_table_insert(&sc2_local, words[i * SC2_LINE_WORDS + j], 1);
+    }
+    sc2_local_words += PAGE_SIZE / 4;
+    sc2_local_pages++;
+}
+
+//merges sample table of this thread
+static void sc2_thread_clean(struct compression * c_p)
+{
+    uint64_t i;
+    if (sc2_local.entry == NULL)
+        return;
+    pthread_mutex_lock(&sc2_lock);
+    if (sc2_global.entry == NULL)
+    {
+        sc2_global.bits = SC2_GLOBAL_BITS;
+        sc2_global.entry = calloc(1ull << SC2_GLOBAL_BITS, sizeof(struct sc2_count));
+    }
+    for (i = 0; i < (1ull << sc2_local.bits); i++)
+        if (sc2_local.entry[i].count != 0)
+            sc2_table_insert(&sc2_global, sc2_local.entry[i].value, sc2_local.entry[i].count);
+    sc2_words += sc2_local_words;
+    sc2_pages += sc2_local_pages;
+    pthread_mutex_unlock(&sc2_lock);
+    free(sc2_local.entry);
+    sc2_local.entry = NULL;
+    sc2_local_words = sc2_local_pages = 0;
+}
+
+static int sc2_count_cmp(const void * a, const void * b)
+{
+    uint64_t ca = ((struct sc2_count *)a)->count, cb = ((struct sc2_count *)b)->count;
+    return ca < cb ? -1 : ca > cb;
+}
+
+//builds global code from the most frequent sampled values
+static void sc2_init(struct compression * c_p, uint8_t * dump, uint64_t size)
+{
+    uint64_t t = sc2_now();
+    uint32_t value[SC2_VALUES];
+    uint64_t count[SC2_VALUES];
+    uint64_t i, used = 0, escape = sc2_words;
+    int n = 0;
+    if (sc2_global.entry != NULL)
+    {
+        for (i = 0; i < (1ull << sc2_global.bits); i++)
+            if (sc2_global.entry[i].count != 0)
+                sc2_global.entry[used++] = sc2_global.entry[i];
+        qsort(sc2_global.entry, used, sizeof(struct sc2_count), sc2_count_cmp);
+        for (i = used > SC2_VALUES ? used - SC2_VALUES : 0; i < used; i++, n++)
+        {
+            value[n] = sc2_global.entry[i].value;
+            count[n] = sc2_global.entry[i].count;
+            escape = escape > count[n] ? escape - count[n] : 0;
+        }
+        free(sc2_global.entry);
+        sc2_global.entry = NULL;
+    }
+    SC2_build(&sc2_code, value, count, n, escape);
+    uint32_t zero[SC2_LINE_WORDS] = {0};
+    sc2_zero_line = SC2_line_size(&sc2_code, zero);
+    sc2_build_ns = sc2_now() - t;
+}
+
+static uint64_t sc2_compression(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f)
+{
+    uint8_t sc2temp[SC2_LINE_WORDS * (4 + SC2_MAX_DEPTH / 8)];
+    uint32_t sc2rev[SC2_LINE_WORDS];
+    uint64_t i, cache_size = 0;
+    if (CACHELINE_SIZE % 64 == 0) // aligned to multiple
+        *report = calloc(sizeof(uint16_t), PAGE_SIZE / CACHELINE_SIZE);
+    uint64_t sum = 0;
+    for (i = 0; i < PAGE_SIZE; i += 64)
+    {
+        int zero = CACHELINE_SIZE == 64 && f->zero_line[i / 64];   //skip zero lines found by driver
+        uint32_t * words = (uint32_t *)(start + i);
+        int s = zero ? sc2_zero_line : SC2_line_size(&sc2_code, words);    // in bits
+        if (c_p->sharedv->parse_switch)
+            s = s > 64 * 8 ? 64 * 8 : s;
+        cache_size += s;
+        if (report != NULL && (i + 64) % CACHELINE_SIZE == 0)
+        {
+            (*report)[i / CACHELINE_SIZE] = cache_size;
+            cache_size = 0;
+        }
+        sum += s;
+        if (c_p->sharedv->validate && !zero && !(s >= 64 * 8 && c_p->sharedv->parse_switch))
+        {
+            int e = SC2_encode_line(&sc2_code, words, sc2temp);
+            int d = SC2_decode_line(&sc2_code, sc2temp, sc2rev);
+            if (e != s || d != s || memcmp(words, sc2rev, 64))
+            {
+                printf("sc2 Error: offset=%"PRIx64"\n", i);
+                return ERROR_SIZE;
+            }
+        }
+    }
+    return sum;
+}
+
+static void sc2_clean(struct compression * c_p)
+{
+    int i, longest = 0;
+    for (i = 0; i < SC2_SYMBOLS; i++)
+        longest = sc2_code.len[i] > longest ? sc2_code.len[i] : longest;
+    printf("sc2 code:%d values:longest %d bits:escape %d bits:%"PRIu64" words sampled from %"PRIu64" pages:build %lfms\n",
+        sc2_code.values, longest, sc2_code.len[SC2_ESCAPE], sc2_words, sc2_pages, sc2_build_ns / 1000000.0);
+}
+
+struct compression COMPRESSION_NODE_NAME = {
+    .next = NULL,
+    .name = "sc2",
+    .compress = (run_compression_t)sc2_compression,
+    .sample = (compression_sample_t)sc2_sample,
+    .thread_clean = (compression_thread_clean_t)sc2_thread_clean,
+    .init = (compression_init_t)sc2_init,
+    .clean = (compression_clean_t)sc2_clean
+};
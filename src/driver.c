@@ -26,9 +26,16 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <math.h>
-#include <elf.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <plugin_struct.h>
+#include <result_cache.h>
+#include <snapshot.h>
+#include <dump.h>
+#include <results.h>
 
 //Size of slices of memoory dump for threads to run.
 //It sould be small enough to ultilize multiprocessor,
@@ -49,6 +56,30 @@ static pthread_mutex_t zero_lock;
 static int zero_switch;
 //shared structure between all layouts and compressions.
 static struct shared * sh;
+//-g sub-page units to measure page-level compressions with, in bytes
+#define MAX_GRANULARITY (8)
+static int granularity[MAX_GRANULARITY];
+static int granularity_count;
+
+//-r persistent result cache, NULL if not used
+static struct result_cache * cache;
+#define RESULT_CACHE_DEFAULT_MB (1024)
+//-b baseline results and -w results to write for snapshot diff, NULL if not used
+static struct snapshot * baseline, * snapshot_out;
+//measured part of -B baseline dump to compare pages with, NULL to compare page hashes
+static uint8_t * baseline_dump;
+static uint64_t baseline_dump_pages;
+static uint64_t snapshot_changed, snapshot_same;
+//-o columnar results file, NULL if not used
+static struct results * results_out;
+static int results_columns;
+//-D histogram buckets of ns. 16 exact buckets, then 8 buckets for each power of 2
+#define DECOMPRESS_BUCKETS (512)
+//lines timed in each page by -D, the rest of the page is timed as a whole
+#define DECOMPRESS_LINES (8)
+
+//c*log2(c) for byte counts in a page, for entropy of page features
+static double clog2c[PAGE_SIZE + 1];
 
 #ifdef TIME
 clock_t g_clock;
@@ -62,50 +93,212 @@ static void errorlog(char * errmsg)
     exit(EXIT_FAILURE);
 }
 
+//finds measured part of dump, see dump.h
+static void auto_elf_parse(char * fn, uint64_t * start, uint64_t * end)
+{
+    if (!dump_range(fn, start, end))
+        errorlog("elf parse failed");
+}
+
+//fills c*log2(c) table used by page_features_compute
+static void page_features_init()
+{
+    int i;
+    clog2c[0] = 0;
+    for (i = 1; i <= PAGE_SIZE; i++)
+        clog2c[i] = i * log2(i);
+}
+
 /*
-    Uses elf.h to read and parse dump file.
-    Automatically revert to parsed file if the input file is not an elf file.
-    Looks for start and end of program section(page-aligned memory section) and uses it for compression.
+    Computes page features shared by all compressions and layouts, in one pass of the page.
+    Zero cachelines and repeated words are checked with SSE2 when available.
+*/
+static void page_features_compute(struct page_features * f, uint8_t * page, uint64_t index)
+{
+    int i, j;
+    f->data = page;
+    f->index = index;
+    f->zero_page = 1;
+    for (i = 0; i < PAGE_SIZE; i += CACHELINE_SIZE)
+    {
+#if defined(__SSE2__) && CACHELINE_SIZE % 16 == 0
+        __m128i acc = _mm_setzero_si128();
+        for (j = 0; j < CACHELINE_SIZE; j += 16)
+            acc = _mm_or_si128(acc, _mm_loadu_si128((__m128i *)(page + i + j)));
+        f->zero_line[i/CACHELINE_SIZE] = _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) == 0xffff;
+#else
+        uint8_t acc = 0;
+        for (j = 0; j < CACHELINE_SIZE; j++)
+            acc |= page[i + j];
+        f->zero_line[i/CACHELINE_SIZE] = !acc;
+#endif
+        f->zero_page &= f->zero_line[i/CACHELINE_SIZE];
+    }
+    if (f->zero_page)   //known without another pass
+    {
+        memset(f->histogram, 0, sizeof(f->histogram));
+        memset(f->word_width, 0, sizeof(f->word_width));
+        f->histogram[0] = PAGE_SIZE;
+        f->word_width[0] = PAGE_SIZE / 8;
+        f->entropy = 0;
+        f->repeated_words = PAGE_SIZE / 8 - 1;
+        f->same_filled = 1;
+        return;
+    }
 
-    This always assumes 4096byte page size for real-word dump files.
+    //byte histogram in 4 banks, so runs of one byte don't stall on one counter
+    uint32_t bank[4][256];
+    memset(bank, 0, sizeof(bank));
+    for (i = 0; i < PAGE_SIZE; i += 4)
+    {
+        bank[0][page[i]]++;
+        bank[1][page[i + 1]]++;
+        bank[2][page[i + 2]]++;
+        bank[3][page[i + 3]]++;
+    }
+    double sum = 0;
+    for (i = 0; i < 256; i++)
+    {
+        f->histogram[i] = bank[0][i] + bank[1][i] + bank[2][i] + bank[3][i];
+        sum += clog2c[f->histogram[i]];
+    }
+    f->entropy = log2(PAGE_SIZE) - sum / PAGE_SIZE;
+
+    //repeated values and width of 8-byte words
+    uint64_t * words = (uint64_t *)page;
+    memset(f->word_width, 0, sizeof(f->word_width));
+    f->repeated_words = 0;
+    for (i = 0; i < PAGE_SIZE / 8; i++)
+        f->word_width[words[i] ? (71 - __builtin_clzll(words[i])) / 8 : 0]++;
+#ifdef __SSE2__
+    //compare words 1,2 with words 0,1 and so on
+    for (i = 1; i + 2 <= PAGE_SIZE / 8; i += 2)
+    {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i *)(words + i)), _mm_loadu_si128((__m128i *)(words + i - 1)));
+        int m = _mm_movemask_epi8(eq);
+        f->repeated_words += ((m & 0xff) == 0xff) + ((m >> 8) == 0xff);
+    }
+    for (; i < PAGE_SIZE / 8; i++)
+        f->repeated_words += words[i] == words[i - 1];
+#else
+    for (i = 1; i < PAGE_SIZE / 8; i++)
+        f->repeated_words += words[i] == words[i - 1];
+#endif
+    f->same_filled = f->repeated_words == PAGE_SIZE / 8 - 1;
+}
+
+static uint64_t now_ns()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static int decompress_bucket(uint64_t ns)
+{
+    if (ns < 16)
+        return ns;
+    int b = 63 - __builtin_clzll(ns);
+    return 16 + (b - 4) * 8 + ((ns >> (b - 3)) & 7);
+}
+
+//smallest ns of bucket
+static uint64_t decompress_bucket_ns(int bucket)
+{
+    if (bucket < 16)
+        return bucket;
+    int b = (bucket - 16) / 8 + 4;
+    return (1ull << b) + ((uint64_t)((bucket - 16) % 8) << (b - 3));
+}
+
+/*
+    -D. Times decompression of the page that was just compressed with p, as a whole and by line.
+    Lines are spread over the page and start at a different line for each page.
 */
-static void auto_elf_parse(char * fn, uint64_t * start, uint64_t * end)
+static void decompress_time(struct compression * p, uint64_t page)
+{
+    int r, i, lines = PAGE_SIZE / CACHELINE_SIZE;
+    int n = lines < DECOMPRESS_LINES ? lines : DECOMPRESS_LINES;
+    int stride = lines / n;
+    uint64_t t = now_ns();
+    for (r = 0; r < sh->decompress_repeat; r++)
+        p->decompress(p, -1);
+    uint64_t page_ns = (now_ns() - t) / sh->decompress_repeat;
+    t = now_ns();
+    for (r = 0; r < sh->decompress_repeat; r++)
+        for (i = 0; i < n; i++)
+            p->decompress(p, i * stride + page % stride);
+    uint64_t line_ns = (now_ns() - t) / (sh->decompress_repeat * n);
+    pthread_mutex_lock(&(p->slock));
+    p->decompress_hist[decompress_bucket(page_ns)]++;
+    p->decompress_hist[DECOMPRESS_BUCKETS + decompress_bucket(line_ns)]++;
+    pthread_mutex_unlock(&(p->slock));
+}
+
+//prints p50, p90 and p99 of histogram
+static void decompress_print(uint64_t * hist)
+{
+    double q[3] = {0.5, 0.9, 0.99};
+    uint64_t total = 0, sum = 0;
+    int i, j = 0;
+    for (i = 0; i < DECOMPRESS_BUCKETS; i++)
+        total += hist[i];
+    for (i = 0; i < DECOMPRESS_BUCKETS && j < 3; i++)
+        for (sum += hist[i]; j < 3 && sum > 0 && sum >= q[j] * total; j++)
+            printf(j ? "/%"PRIu64 : "%"PRIu64, decompress_bucket_ns(i));
+    printf(":");
+}
+
+//per-thread buffers of -o for a slice, written to results file when the slice is done
+struct results_buffer
+{
+    uint64_t first, pages;
+    uint16_t * sizes;   //by column, then page
+    uint16_t * lines;   //by column, then page and cacheline. NULL without cacheline columns
+    uint8_t * zero;     //zero cacheline bitmap by page
+};
+
+static void results_buffer_init(struct results_buffer * b, uint64_t first, uint64_t pages)
+{
+    b->first = first;
+    b->pages = pages;
+    b->sizes = malloc(sizeof(uint16_t) * results_columns * pages);
+    b->lines = results_out->header->lines ? malloc(sizeof(uint16_t) * results_columns * pages * RESULTS_LINES) : NULL;
+    b->zero = calloc(RESULTS_ZERO_BYTES, pages);
+}
+
+//size and cacheline report of page in column, report is NULL for zero pages and compressions without one
+static void results_buffer_page(struct results_buffer * b, int column, uint64_t page, uint16_t size, uint16_t * report)
 {
-    Elf64_Ehdr header;
-    FILE * ef = fopen(fn, "rb");
-    if (!ef)
-        errorlog("elf parse failed at open file");
-    if (fread(&header, 1, sizeof(header), ef) <= 0)
-        errorlog("elf parse failed at read");
-    *start = 0;
-    if (!!memcmp(header.e_ident, ELFMAG, SELFMAG))
-        //assume parsed
-        *end = -1;
+    b->sizes[column * b->pages + page] = size;
+    if (b->lines == NULL)
+        return;
+    uint16_t * lines = b->lines + (column * b->pages + page) * RESULTS_LINES;
+    int i;
+    if (report != NULL)
+    {
+        memcpy(lines, report, sizeof(uint16_t) * RESULTS_LINES);
+        if (!results_out->column[column].has_lines)
+            __atomic_store_n(&results_out->column[column].has_lines, 1, __ATOMIC_RELAXED);
+    }
     else
+        for (i = 0; i < RESULTS_LINES; i++)
+            lines[i] = RESULTS_ZERO;
+}
+
+static void results_buffer_flush(struct results_buffer * b)
+{
+    int i;
+    for (i = 0; i < results_columns; i++)
     {
-        *end = header.e_shoff; // end of program section. start of next section
-        *start = 0;
-        fseek(ef, header.e_phoff, SEEK_SET);
-        int i;
-        for (i = 0; i < header.e_phnum; i++) // Find the first aligned program section
-        {
-            Elf64_Phdr pHdr;
-            if (fread(&pHdr, 1, sizeof(Elf64_Phdr), ef) <= 0)
-                errorlog("elf parse failed at reading psect");
-            if (pHdr.p_memsz != 0 && (pHdr.p_memsz & (0xfff)) == 0)
-            {
-                *start = pHdr.p_offset;
-                break;
-            }
-        }
+        results_write(results_out, i, b->first, b->sizes + i * b->pages, b->pages);
+        if (b->lines != NULL)
+            results_write_lines(results_out, i, b->first, b->lines + i * b->pages * RESULTS_LINES, b->pages);
     }
-    fseek(ef, 0L, SEEK_END);
-    uint64_t cap = ftell(ef);
-    if (cap < *end)
-        //for elf file that failed half way generating
-        *end = cap;
-    fclose(ef);
-    *end = *start + ((*end - *start) & ~0xfff);
+    results_write_zero(results_out, b->first, b->zero, b->pages);
+    free(b->sizes);
+    free(b->lines);
+    free(b->zero);
 }
 
 /*
@@ -118,44 +311,109 @@ static void * run_compress(void * block)
     uint64_t cur, size = *((uint64_t *)block + 1);          //slice length for this thread to measure
     uint64_t index = *((uint64_t *)block + 2) / PAGE_SIZE;  //index of page_report
     int zeroc = 0;
+    uint64_t changedc = 0, samec = 0;
+    struct page_features * features = malloc(sizeof(struct page_features));
+    struct results_buffer rb;
+    if (results_out != NULL)
+        results_buffer_init(&rb, index, size / PAGE_SIZE);
     //iterate through slice, page by page
     for (cur = 0; cur < size; cur += PAGE_SIZE)
     {
-        int j, i = 0;
-        uint8_t c_map[PAGE_SIZE/CACHELINE_SIZE];
-        if (zero_switch)
+        int j, k;
+        page_features_compute(features, file + cur, index + cur / PAGE_SIZE);
+        if (results_out != NULL)
+            for (j = 0; j < RESULTS_LINES; j++)
+                rb.zero[cur / PAGE_SIZE * RESULTS_ZERO_BYTES + j / 8] |= features->zero_line[j] << (j % 8);
+        features->history = cur;
+        int zero_page = zero_switch && features->zero_page;
+        zeroc += zero_page;
+        uint64_t page = index + cur / PAGE_SIZE;
+        struct pagehash hash = {0, 0};
+        if ((cache != NULL || baseline != NULL || snapshot_out != NULL) && !zero_page)
+            hash = pagehash_compute(file + cur, PAGE_SIZE);
+        struct snapshot_record * old = NULL, * out = NULL;
+        int changed = 0;
+        if (snapshot_out != NULL)
         {
-            for (i = 0; i < PAGE_SIZE; i += CACHELINE_SIZE)
-            {
-                for (j = 0; j < CACHELINE_SIZE; j++)
-                    if ((file + cur + i)[j] != 0)
-                        j = CACHELINE_SIZE + 1;
-                c_map[i/CACHELINE_SIZE] = j == CACHELINE_SIZE ? 1: 0;
-            }
-            for (i = 0; i < PAGE_SIZE/CACHELINE_SIZE; i++)
-                i = !(c_map[i]) ? PAGE_SIZE/CACHELINE_SIZE + 1 : i;
-            zeroc += (i == PAGE_SIZE/CACHELINE_SIZE);
+            out = snapshot_record(snapshot_out, page);
+            out->hash = hash;
+        }
+        if (baseline != NULL && !zero_page)
+        {
+            if (page < baseline->header->pages)
+                old = snapshot_record(baseline, page);
+            if (baseline_dump != NULL)
+                changed = page >= baseline_dump_pages || memcmp(baseline_dump + page * PAGE_SIZE, file + cur, PAGE_SIZE);
+            else
+                changed = old == NULL || old->hash.lo != hash.lo || old->hash.hi != hash.hi;
+            changedc += changed;
+            samec += !changed;
         }
         struct compression * p;
-        for (p = compressionp; p != NULL; p = p->next)
+        for (p = compressionp, k = 0; p != NULL; p = p->next, k++)
         {
-            if (zero_switch && i == PAGE_SIZE/CACHELINE_SIZE) //zero page. fill page report entry by ZERO_SIZE
+            if (zero_page) //zero page. fill page report entry by ZERO_SIZE
             {
                 if (layoutp != NULL)
                     p->page_report[index + cur / PAGE_SIZE] = ZERO_SIZE;
+                if (out != NULL && p->column >= 0)
+                    out->size[p->column] = SNAPSHOT_NONE;
+                if (results_out != NULL)
+                    results_buffer_page(&rb, k, cur / PAGE_SIZE, RESULTS_ZERO, NULL);
                 continue;
             }
+            uint32_t * old_size = old != NULL && p->snapshot_column >= 0 && old->size[p->snapshot_column] != SNAPSHOT_NONE ?
+                &old->size[p->snapshot_column] : NULL;
+            //unchanged page keeps result of baseline
+            int reuse = !changed && old_size != NULL && p->cacheable && !sh->validate;
             uint16_t * cachereport = NULL;
+            //high entropy page. report as uncompressed for opted-in compressions
+            int skip = sh->prefilter > 0 && p->prefilter && features->entropy > sh->prefilter;
+            int false_skip = 0, hit = 0, lookup = 0;
+            uint64_t result = PAGE_SIZE * 8;
             #ifdef TIME
             clock_t time_clock = clock();
             #endif
-            uint64_t result = p->compress(p, file + cur, &cachereport); //get compression result
+            if (reuse)
+            {
+                skip = (*old_size & SNAPSHOT_SKIPPED) != 0;
+                false_skip = (*old_size & SNAPSHOT_FALSE_SKIP) != 0;
+                result = SNAPSHOT_SIZE(*old_size);
+            }
+            else if (!skip && cache != NULL && p->cacheable && !sh->validate)
+            {
+                //results depend only on page content, so a result of any run or dump can be used
+                struct pagehash key = result_cache_key(hash, p->cache_id);
+                lookup = 1;
+                hit = result_cache_lookup(cache, key, &result, &cachereport);
+                if (!hit)
+                {
+                    result = p->compress(p, file + cur, &cachereport, features);
+                    if (result != ERROR_SIZE)
+                        result_cache_insert(cache, key, result, cachereport);
+                }
+            }
+            else if (!skip)
+                result = p->compress(p, file + cur, &cachereport, features); //get compression result
+            else if (sh->prefilter_verify)
+            {
+                uint64_t check = p->compress(p, file + cur, &cachereport, features);
+                false_skip = check != ERROR_SIZE && check < PAGE_SIZE * 8;
+                if (cachereport != NULL)
+                {
+                    free(cachereport);
+                    cachereport = NULL;
+                }
+            }
             #ifdef TIME
             time_clock = clock() - time_clock;
             pthread_mutex_lock(&(clock_lock));
             g_clock += time_clock;
             pthread_mutex_unlock(&(clock_lock));
             #endif
+            //only pages just compressed have compressed data to decompress
+            if (p->decompress_hist != NULL && !skip && !reuse && !hit && result != ERROR_SIZE)
+                decompress_time(p, page);
             if (result == ERROR_SIZE) // on error
             {
                 printf("at %"PRIu64"\n", index + cur / PAGE_SIZE);
@@ -163,37 +421,215 @@ static void * run_compress(void * block)
             }
             if (sh->parse_switch)
                 result = result > PAGE_SIZE * 8 ? PAGE_SIZE * 8 : result;
-            if (cachereport != NULL)
+            if (cachereport != NULL && zero_switch)
                 for (j = 0; j < PAGE_SIZE/CACHELINE_SIZE; j++)
-                    if (c_map[j])
+                    if (features->zero_line[j])
                         cachereport[j] = ZERO_CACHELINE(cachereport[j]);
             struct layout * lp = layoutp;
             for (lp = layoutp; lp != NULL; lp = lp->next)
-                lp->L_page_r(p, cachereport, result);
+                lp->L_page_r(p, cachereport, result, features);
+            if (results_out != NULL)
+                results_buffer_page(&rb, k, cur / PAGE_SIZE, result > RESULTS_MAX ? RESULTS_MAX : result, cachereport);
             if (cachereport != NULL)
                 free(cachereport);
             pthread_mutex_lock(&(p->slock));
             p->size += result;
+            p->prefilter_skip += skip;
+            p->prefilter_false += false_skip;
+            p->cache_hit += hit;
+            p->cache_lookup += lookup;
+            if (changed && p->snapshot_column >= 0)
+            {
+                p->snapshot_before += old_size != NULL ? SNAPSHOT_SIZE(*old_size) : 0;
+                p->snapshot_after += result;
+            }
             pthread_mutex_unlock(&(p->slock));
+            if (out != NULL && p->column >= 0)
+                out->size[p->column] = result | (skip ? SNAPSHOT_SKIPPED : 0) | (false_skip ? SNAPSHOT_FALSE_SKIP : 0);
             if (layoutp != NULL)
                 p->page_report[index + cur / PAGE_SIZE] = result;
         }
     }
+    free(features);
+    if (results_out != NULL)
+        results_buffer_flush(&rb);
     if (zero_switch)
     {
         pthread_mutex_lock(&zero_lock);
         zero_count += zeroc;
         pthread_mutex_unlock(&zero_lock);
     }
-    sem_post(&thread_ctrl);
-    pthread_detach(pthread_self());
-    free(block);
+    if (baseline != NULL)
+    {
+        pthread_mutex_lock(&zero_lock);
+        snapshot_changed += changedc;
+        snapshot_same += samec;
+        pthread_mutex_unlock(&zero_lock);
+    }
+    //per-thread clean up must finish before main thread is released to print reports
+    struct compression * p;
+    for (p = compressionp; p != NULL; p = p->next)
+        if (p->thread_clean != NULL)
+            p->thread_clean(p);
     struct layout * lp = layoutp;
     for (lp = layoutp; lp != NULL; lp = lp->next)
         lp->L_thread_clean_r();
+    free(block);
+    pthread_detach(pthread_self());
+    sem_post(&thread_ctrl);
+    return NULL;
+}
+
+/*
+    Multithreaded pre-pass. Gives every sample_stride-th page of the slice to compressions that sample,
+    so a compression can build global statistics before the main run.
+*/
+static void * run_sample(void * block)
+{
+    uint8_t * file = *(uint8_t **)block;
+    uint64_t cur, size = *((uint64_t *)block + 1);
+    uint64_t index = *((uint64_t *)block + 2) / PAGE_SIZE;
+    struct page_features * features = malloc(sizeof(struct page_features));
+    struct compression * p;
+    for (cur = (sh->sample_stride - index % sh->sample_stride) % sh->sample_stride * PAGE_SIZE; cur < size; cur += sh->sample_stride * PAGE_SIZE)
+    {
+        page_features_compute(features, file + cur, index + cur / PAGE_SIZE);
+        features->history = cur;
+        if (zero_switch && features->zero_page)
+            continue;
+        for (p = compressionp; p != compressione; p = p->next)
+            if (p->sample != NULL)
+                p->sample(p, file + cur, features);
+    }
+    free(features);
+    for (p = compressionp; p != NULL; p = p->next)
+        if (p->thread_clean != NULL)
+            p->thread_clean(p);
+    free(block);
+    pthread_detach(pthread_self());
+    sem_post(&thread_ctrl);
+    return NULL;
+}
+
+struct parallel_chunk
+{
+    parallel_chunk_t func;
+    void * arg;
+    uint64_t begin, end;
+    int chunk;
+};
+
+static void * parallel_worker(void * arg)
+{
+    struct parallel_chunk * c = arg;
+    c->func(c->arg, c->begin, c->end, c->chunk);
+    sem_post(&thread_ctrl);
+    return NULL;
+}
+
+//sh->parallel_for. Chunks take threads from thread_ctrl as run_threads does, so layouts at the same time share them
+static void parallel_for(uint64_t count, parallel_chunk_t func, void * arg)
+{
+    int i, n = sh->threads;
+    pthread_t * tid = malloc(sizeof(pthread_t) * n);
+    struct parallel_chunk * c = malloc(sizeof(struct parallel_chunk) * n);
+    for (i = 0; i < n; i++)
+    {
+        c[i].func = func;
+        c[i].arg = arg;
+        c[i].begin = count * i / n;
+        c[i].end = count * (i + 1) / n;
+        c[i].chunk = i;
+        sem_wait(&thread_ctrl);
+        pthread_create(&tid[i], NULL, parallel_worker, &c[i]);
+    }
+    for (i = 0; i < n; i++)
+        pthread_join(tid[i], NULL);
+    free(tid);
+    free(c);
+}
+
+static uint64_t final_pages;
+
+static void * run_final(void * arg)
+{
+    struct layout * lp = arg;
+    lp->L_final_r(compressionp, final_pages);
     return NULL;
 }
 
+//runs func on the dump in slices of BLOCK and waits for all threads
+static void run_threads(void * (* func)(void *), uint8_t * file, uint64_t start, uint64_t size)
+{
+    pthread_t tid;
+    uint64_t cur;
+    int i;
+    for (cur = start; cur < size; cur += BLOCK)
+    {
+        sem_wait(&thread_ctrl);
+        uint64_t * block = malloc(sizeof(uint64_t) * 3);
+        block[0] = (uint64_t)file + cur;
+        block[1] = BLOCK > (size - cur) ? (size - cur) : BLOCK;
+        block[2] = cur - start;
+        pthread_create(&tid, NULL, func, block);
+    }
+    for (i = 0; i < sh->threads; i++)
+        sem_wait(&thread_ctrl);
+    for (i = 0; i < sh->threads; i++)
+        sem_post(&thread_ctrl);
+}
+
+/*
+    Compression node made by driver for -g. Compresses the page in units of c_p->granularity
+    with parent compression. Units are compressed right after the parent compressed the page,
+    so the page is still in cache.
+*/
+static uint64_t granularity_compress(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f)
+{
+    int i;
+    uint64_t sum = 0;
+    for (i = 0; i < PAGE_SIZE; i += c_p->granularity)
+    {
+        uint64_t s = c_p->parent->compress_block(c_p->parent, start + i, c_p->granularity);
+        if (s == ERROR_SIZE)
+            return ERROR_SIZE;
+        if (sh->parse_switch)
+            s = s > c_p->granularity * 8 ? c_p->granularity * 8 : s;
+        sum += s;
+    }
+    return sum;
+}
+
+//adds a node after each compression that supports blocks, for each granularity. i.e. lz4@1K
+static void granularity_insert()
+{
+    struct compression * p;
+    int i;
+    for (p = compressionp; p != NULL; p = p->next)
+    {
+        if (p->compress_block == NULL)
+            continue;
+        struct compression * parent = p;
+        for (i = 0; i < granularity_count; i++)
+        {
+            struct compression * g = calloc(1, sizeof(struct compression));
+            char name[256];
+            if (granularity[i] % 1024 == 0)
+                snprintf(name, sizeof name, "%s@%dK", parent->name, granularity[i] / 1024);
+            else
+                snprintf(name, sizeof name, "%s@%d", parent->name, granularity[i]);
+            g->name = strdup(name);
+            g->compress = (run_compression_t)granularity_compress;
+            g->prefilter = parent->prefilter;
+            g->parent = parent;
+            g->granularity = granularity[i];
+            g->next = p->next;
+            p->next = g;
+            p = g;
+        }
+    }
+}
+
 //insert layout to layout list according to priority
 static void layout_insert(struct layout * l)
 {
@@ -218,6 +654,31 @@ static void layout_insert(struct layout * l)
     }
 }
 
+/*
+    Hash of options that change results of compression cp, for its result cache id:
+    -p, and -c options keyed after a prefix of its name, i.e. deflate.level for deflate_l1.
+    -v bypasses the cache and prefiltered pages are not kept, so neither is included
+*/
+static uint64_t cache_options(struct compression * cp)
+{
+    int i;
+    uint64_t h = pagehash_fmix(sh->parse_switch + 1);
+    for (i = 0; i < sh->config_count; i++)
+    {
+        char * dot = strchr(sh->config[i], '.');
+        if (dot != NULL && !strncmp(cp->name, sh->config[i], dot - sh->config[i]))
+        {
+            //pagehash takes multiples of 32 bytes, option is zero padded
+            int len = strlen(sh->config[i]), size = (len + 32) & ~31;
+            uint8_t * buf = calloc(size, 1);
+            memcpy(buf, sh->config[i], len);
+            h = pagehash_fmix(h ^ pagehash_compute(buf, size).lo);
+            free(buf);
+        }
+    }
+    return h;
+}
+
 //Loads layouts and compressions from .so files
 static void load_initialize_compressions(uint64_t pg_count, int load_layouts)
 {
@@ -231,6 +692,7 @@ static void load_initialize_compressions(uint64_t pg_count, int load_layouts)
     layoutp = NULL;
     struct compression * cp;
     struct layout * tl;
+    sh->totalpages = pg_count;
     while ((dentry = readdir(dir)) != NULL)
     {
         if (!strstr(dentry->d_name, ".so"))
@@ -250,6 +712,9 @@ static void load_initialize_compressions(uint64_t pg_count, int load_layouts)
             dlclose(handle);
             errorlog("error in loading compression");
         }
+        p->sharedv = sh;
+        if (p->configure != NULL)
+            p->configure(p);
         cp = p;
         while (cp->next != NULL)
             cp = cp->next;
@@ -259,6 +724,10 @@ static void load_initialize_compressions(uint64_t pg_count, int load_layouts)
         compressionp = p;       //add to top
     }
     closedir(dir);
+    granularity_insert();
+    if (compressione != NULL)   //granularity nodes may be added after tail
+        while (compressione->next != NULL)
+            compressione = compressione->next;
     if (load_layouts)
     {
         dir = opendir(layout_folder);
@@ -305,6 +774,17 @@ static void load_initialize_compressions(uint64_t pg_count, int load_layouts)
     {
         cp->slock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
         cp->size = 0;
+        cp->prefilter_skip = 0;
+        cp->prefilter_false = 0;
+        cp->cache_id = result_cache_id(cp->name, cp->version, cache_options(cp));
+        cp->cache_hit = 0;
+        cp->cache_lookup = 0;
+        cp->column = -1;
+        cp->snapshot_column = -1;
+        cp->snapshot_before = 0;
+        cp->snapshot_after = 0;
+        if (sh->decompress_repeat > 0 && cp->decompress != NULL)
+            cp->decompress_hist = calloc(sizeof(uint64_t), 2 * DECOMPRESS_BUCKETS);
         cp->sharedv = sh;
         if (layoutp != NULL)
             cp->page_report = calloc(sizeof(uint16_t), pg_count);
@@ -313,13 +793,16 @@ static void load_initialize_compressions(uint64_t pg_count, int load_layouts)
         compressione = compressione->next; // next to tail
     else
         compressione = compressionp;
-    
+    int i = 0;
+    for (cp = compressionp; cp != compressione; cp = cp->next)
+        cp->column = i++;
+
 }
 
 //prints usage and quit
 static void usage(char * name, char * errmsg)
 {
-    printf("Usage: %s [-f filename] [-n thread_count] [-v] [-z] [-p] [-h] [-l] [-a]\n", name);
+    printf("Usage: %s [-f filename] [-n thread_count] [-v] [-z] [-p] [-h] [-l] [-a] [-e entropy] [-E] [-g sizes] [-s stride] [-r cachefile[,MB]] [-w results] [-b baseline_results] [-B baseline_dump] [-D repeat] [-c key=value] [-o results[,lines]]\n", name);
     printf("Where -n thread count, default is 4\n");
     printf("      -v is for validation (check decompression).\n");
     printf("      -z if you want to include zero pages in calculation.\n");
@@ -327,6 +810,17 @@ static void usage(char * name, char * errmsg)
     printf("      -h removes report header.\n");
     printf("      -l run without memory layouts\n");
     printf("      -a print compressed size in bits. default is ratio\n");
+    printf("      -e skip pages with byte entropy above this many bits per byte in opted-in compressions\n");
+    printf("      -E compress skipped pages anyway to report false skips of -e\n");
+    printf("      -g comma separated unit sizes in bytes, i.e. 512,1024,2048. Also measures page-level compressions in these units\n");
+    printf("      -s pre-pass samples 1 of this many pages for compressions that sample, default is 16\n");
+    printf("      -r keep results of compressions that opt in by page content in this file across runs, default size is %dMB\n", RESULT_CACHE_DEFAULT_MB);
+    printf("      -w write per-page results to this file, to be a baseline of a later snapshot\n");
+    printf("      -b baseline results of an earlier snapshot. Only changed pages are compressed again. Runs without layouts\n");
+    printf("      -B with -b, baseline dump to find changed pages by comparing pages instead of page hashes\n");
+    printf("      -D decompress every page this many times and report ns per page and per cacheline, for compressions that support it\n");
+    printf("      -c option of a compression or layout, i.e. costmodel.burst=32. Can be given more than once\n");
+    printf("      -o write per-page sizes of every compression and layout report to this columnar file. Add ,lines to keep cacheline sizes\n");
 
     if (errmsg != NULL)
         errorlog(errmsg);
@@ -344,9 +838,26 @@ int main(int argc, char ** argv)
     zero_switch = 1;
     sh->parse_switch = 1;
     sh->header = 1;
+    sh->prefilter = 0;
+    sh->prefilter_verify = 0;
+    sh->sample_stride = 16;
+    sh->decompress_repeat = 0;
+    sh->config = NULL;
+    sh->config_count = 0;
+    sh->parallel_for = parallel_for;
+    granularity_count = 0;
     int actual_size = 0;
     int load_layouts = 1;
-    while ((opt = getopt(argc, argv, "hpvf:n:zla")) != -1)
+    char * cache_fn = NULL;
+    char * out_fn = NULL, * baseline_fn = NULL, * baseline_dump_fn = NULL;
+    char * results_fn = NULL;
+    int results_lines = 0, failed = 0;
+    uint64_t cache_mb = RESULT_CACHE_DEFAULT_MB;
+    cache = NULL;
+    baseline = snapshot_out = NULL;
+    results_out = NULL;
+    baseline_dump = NULL;
+    while ((opt = getopt(argc, argv, "hpvf:n:zlae:Eg:s:r:w:b:B:D:c:o:")) != -1)
         switch (opt) {
             case 'l':
                 load_layouts = 0;
@@ -372,6 +883,58 @@ int main(int argc, char ** argv)
             case 'a':
                 actual_size = 1;
                 break;
+            case 'e':
+                sh->prefilter = strtod(optarg, NULL);
+                break;
+            case 'E':
+                sh->prefilter_verify = 1;
+                break;
+            case 's':
+                sh->sample_stride = strtol(optarg, NULL, 0);
+                break;
+            case 'r':
+                cache_fn = strtok(optarg, ",");
+                if ((optarg = strtok(NULL, ",")) != NULL)
+                    cache_mb = strtol(optarg, NULL, 0);
+                break;
+            case 'w':
+                out_fn = optarg;
+                break;
+            case 'o':
+                results_fn = strtok(optarg, ",");
+                if ((optarg = strtok(NULL, ",")) != NULL)
+                    results_lines = !strcmp(optarg, "lines");
+                break;
+            case 'b':
+                baseline_fn = optarg;
+                break;
+            case 'B':
+                baseline_dump_fn = optarg;
+                break;
+            case 'D':
+                sh->decompress_repeat = strtol(optarg, NULL, 0);
+                break;
+            case 'c':
+                if (strchr(optarg, '=') == NULL)
+                    usage(argv[0], "config option should be key=value");
+                sh->config = realloc(sh->config, sizeof(char *) * (sh->config_count + 1));
+                sh->config[sh->config_count++] = optarg;
+                break;
+            case 'g':
+            {
+                char * tok;
+                for (tok = strtok(optarg, ","); tok != NULL; tok = strtok(NULL, ","))
+                {
+                    if (granularity_count == MAX_GRANULARITY)
+                        usage(argv[0], "too many unit sizes");
+                    granularity[granularity_count] = strtol(tok, NULL, 0);
+                    if (granularity[granularity_count] <= 0 || granularity[granularity_count] >= PAGE_SIZE
+                        || PAGE_SIZE % granularity[granularity_count] != 0)
+                        usage(argv[0], "unit size should be smaller than and divide page size");
+                    granularity_count++;
+                }
+                break;
+            }
             default:
                 usage(argv[0], NULL);
         }
@@ -379,11 +942,41 @@ int main(int argc, char ** argv)
         usage(argv[0], "Filename required.");
     if (sh->threads <= 0)
         usage(argv[0], "thread count invalid");
+    if (sh->prefilter < 0 || sh->prefilter > 8)
+        usage(argv[0], "entropy threshold should be within 0 to 8 bits per byte");
+    if (sh->sample_stride <= 0)
+        usage(argv[0], "sample stride invalid");
+    if (sh->decompress_repeat < 0)
+        usage(argv[0], "decompression repeat count invalid");
+    if (cache_fn != NULL)
+    {
+        cache = malloc(sizeof(struct result_cache));
+        if (!result_cache_open(cache, cache_fn, cache_mb << 20))
+            usage(argv[0], "Cannot open result cache file.");
+    }
+    if (baseline_dump_fn != NULL && baseline_fn == NULL)
+        usage(argv[0], "baseline dump needs baseline results");
+    if (baseline_fn != NULL)
+    {
+        baseline = malloc(sizeof(struct snapshot));
+        if (!snapshot_open(baseline, baseline_fn))
+            usage(argv[0], "Cannot open baseline results.");
+        if (baseline->header->parse_switch != sh->parse_switch || baseline->header->zero_switch != zero_switch
+            || baseline->header->prefilter != sh->prefilter)
+            usage(argv[0], "baseline results were made with different -p, -z or -e");
+        //layouts need every page compressed
+        load_layouts = 0;
+    }
+    if (baseline_dump_fn != NULL)
+    {
+        baseline_dump = dump_map(baseline_dump_fn, &baseline_dump_pages);
+        if (baseline_dump == NULL)
+            usage(argv[0], "Cannot open baseline dump.");
+    }
     
     //parse and load file and shared objects
-    uint64_t start, cur, size;
+    uint64_t start, size;
     auto_elf_parse(sh->filename, &start, &size);
-    cur = start;
     int fd = open(sh->filename, O_RDONLY);
     if (fd < 0) usage(argv[0], "Cannot open file.");
 
@@ -391,30 +984,84 @@ int main(int argc, char ** argv)
     g_clock = 0;
     clock_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
     #endif
-    load_initialize_compressions((size - cur) / PAGE_SIZE, load_layouts);
+    page_features_init();
+    load_initialize_compressions((size - start) / PAGE_SIZE, load_layouts);
     uint8_t * file = mmap(0, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
-    //ready for compressions
     sem_init(&thread_ctrl, 0, sh->threads);
-    zero_count = 0;
-    pthread_t tid;
-    while (cur < size)
+    struct compression * p;
+    int i;
+    if (baseline != NULL)
+        for (p = compressionp; p != compressione; p = p->next)
+            for (i = 0; i < baseline->header->columns; i++)
+                if (!strncmp(baseline->column[i].name, p->name, sizeof(baseline->column[i].name) - 1)
+                    && baseline->column[i].version == p->version)
+                    p->snapshot_column = i;
+    snapshot_changed = snapshot_same = 0;
+    if (out_fn != NULL)
     {
-        sem_wait(&thread_ctrl);
-        uint64_t * block = malloc(sizeof(uint64_t) * 3);
-        block[0] = (uint64_t)file + cur;
-        block[1] = BLOCK > (size - cur) ? (size - cur) : BLOCK;
-        block[2] = cur - start;
-        pthread_create(&tid, NULL, run_compress, block);
-        cur += BLOCK;
+        for (i = 0, p = compressionp; p != compressione; p = p->next)
+            i++;
+        snapshot_out = malloc(sizeof(struct snapshot));
+        if (!snapshot_create(snapshot_out, out_fn, i, (size - start) / PAGE_SIZE))
+            usage(argv[0], "Cannot create results file.");
+        snapshot_out->header->parse_switch = sh->parse_switch;
+        snapshot_out->header->zero_switch = zero_switch;
+        snapshot_out->header->prefilter = sh->prefilter;
+        for (p = compressionp; p != compressione; p = p->next)
+        {
+            strncpy(snapshot_out->column[p->column].name, p->name, sizeof(snapshot_out->column[p->column].name) - 1);
+            snapshot_out->column[p->column].version = p->version;
+        }
     }
-    int i;
-    for (i = 0; i < sh->threads; i++)
-        sem_wait(&thread_ctrl);
+    if (results_fn != NULL)
+    {
+        struct dump_segment * seg;
+        int segs = dump_segments(sh->filename, &seg);
+        for (results_columns = 0, p = compressionp; p != NULL; p = p->next)
+            results_columns++;
+        results_out = malloc(sizeof(struct results));
+        if (!results_create(results_out, results_fn, results_columns, (size - start) / PAGE_SIZE, results_lines, seg, segs))
+            usage(argv[0], "Cannot create results file.");
+        free(seg);
+        results_out->header->start = start;
+        results_out->header->end = size;
+        results_out->header->parse_switch = sh->parse_switch;
+        results_out->header->zero_switch = zero_switch;
+        strncpy(results_out->header->filename, sh->filename, sizeof(results_out->header->filename) - 1);
+        //layout reports follow compressions
+        int kind = RESULTS_COMPRESSION;
+        for (i = 0, p = compressionp; p != NULL; p = p->next, i++)
+        {
+            kind = p == compressione ? RESULTS_LAYOUT : kind;
+            results_name(results_out, i, p->name, p->version, kind);
+        }
+    }
+    for (p = compressionp; p != compressione && p->sample == NULL; p = p->next);
+    if (p != compressione)
+        run_threads(run_sample, file, start, size);
+    for (p = compressionp; p != compressione; p = p->next)
+        if (p->init != NULL)
+            p->init(p, file + start, size - start);
+    //ready for compressions
+    zero_count = 0;
+    run_threads(run_compress, file, start, size);
     //print report
-    struct compression * p;
     struct layout * lp;
+    int final_count = 0;
+    final_pages = (size - start) / PAGE_SIZE;
+    for (lp = layoutp; lp != NULL; lp = lp->next)
+        final_count += lp->final_independent;
+    pthread_t * final_tid = malloc(sizeof(pthread_t) * (final_count + 1));
+    final_count = 0;
+    for (lp = layoutp; lp != NULL; lp = lp->next)
+        if (lp->final_independent)
+            pthread_create(&final_tid[final_count++], NULL, run_final, lp);
+    while (final_count > 0)
+        pthread_join(final_tid[--final_count], NULL);
+    free(final_tid);
     for (lp = layoutp; lp != NULL; lp = lp->next)
-        lp->L_final_r(compressionp, (size - start) / PAGE_SIZE);
+        if (!lp->final_independent)
+            lp->L_final_r(compressionp, final_pages);
     if (sh->header)
     {
         printf("file name,file size,elf,");
@@ -470,16 +1117,97 @@ int main(int argc, char ** argv)
         }
     }
     printf("\n");
+    if (sh->prefilter > 0)
+    {
+        printf("Prefilter skipped:");
+        for (p = compressionp; p != compressione; p = p->next)
+            if (p->prefilter)
+                printf("%s=%"PRIu64":", p->name, p->prefilter_skip);
+        if (sh->prefilter_verify)
+        {
+            printf("\nPrefilter false skip:");
+            for (p = compressionp; p != compressione; p = p->next)
+                if (p->prefilter)
+                    printf("%s=%"PRIu64"(%lf):", p->name, p->prefilter_false,
+                        p->prefilter_skip ? p->prefilter_false / (double)p->prefilter_skip : 0);
+        }
+        printf("\n");
+    }
+    if (cache != NULL)
+    {
+        uint64_t hits = 0, lookups = 0;
+        printf("Result cache hits:");
+        for (p = compressionp; p != compressione; p = p->next)
+            if (p->cacheable)
+            {
+                printf("%s=%"PRIu64"/%"PRIu64":", p->name, p->cache_hit, p->cache_lookup);
+                hits += p->cache_hit;
+                lookups += p->cache_lookup;
+            }
+        printf("hit rate=%lf:evictions=%"PRIu64":run=%u\n", lookups ? hits / (double)lookups : 0, cache->evictions, cache->run);
+        result_cache_close(cache);
+        free(cache);
+    }
+    if (sh->decompress_repeat > 0)
+    {
+        printf("Decompression ns per page(p50/p90/p99):");
+        for (p = compressionp; p != compressione; p = p->next)
+            if (p->decompress_hist != NULL)
+            {
+                printf("%s=", p->name);
+                decompress_print(p->decompress_hist);
+            }
+        printf("\nDecompression ns per cacheline(p50/p90/p99):");
+        for (p = compressionp; p != compressione; p = p->next)
+            if (p->decompress_hist != NULL)
+            {
+                printf("%s=", p->name);
+                decompress_print(p->decompress_hist + DECOMPRESS_BUCKETS);
+                free(p->decompress_hist);
+            }
+        printf("\n");
+    }
+    if (baseline != NULL)
+    {
+        printf("Snapshot diff:changed pages=%"PRIu64"(%lf):unchanged pages=%"PRIu64"\n", snapshot_changed,
+            snapshot_changed + snapshot_same ? snapshot_changed / (double)(snapshot_changed + snapshot_same) : 0, snapshot_same);
+        printf("Snapshot churn(size of changed pages in baseline:now):");
+        for (p = compressionp; p != compressione; p = p->next)
+            if (p->snapshot_column >= 0)
+                printf("%s=%"PRIu64":%"PRIu64":", p->name, p->snapshot_before, p->snapshot_after);
+        printf("\n");
+        snapshot_close(baseline);
+        free(baseline);
+    }
+    if (snapshot_out != NULL)
+    {
+        snapshot_close(snapshot_out);
+        free(snapshot_out);
+    }
+    if (results_out != NULL)
+    {
+        if (!results_close(results_out))
+        {
+            printf("Cannot write results file %s.\n", results_fn);
+            failed = 1;
+        }
+        free(results_out);
+    }
+    for (p = compressionp; p != compressione; p = p->next)
+        if (p->clean != NULL)
+            p->clean(p);
     lp = layoutp;
     while (lp != NULL)
     {
         lp->L_clean_r();
         lp = lp->next;
     }
+    free(sh->config);
     free(sh);
     #ifdef TIME
     double sec = ((double)(g_clock))/CLOCKS_PER_SEC;
     printf("Time spent on compress: %lf\n", sec);
     pthread_mutex_destroy(&clock_lock);
     #endif
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
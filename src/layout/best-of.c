@@ -6,6 +6,14 @@
 
     A seperate report will be produced in the end for compressed size for each part
 
+    The list is set at runtime by -c best-of.list=name,name,... and can hold up to LIST_MAX compressions.
+    Smallest sizes of a page are kept in a per-thread record of that page, and cachelines won by
+    each compression are counted per thread and merged when the thread exits.
+    More lists can be set by -c best-of.variants=name,name;name,name;... and are reported as best-of#n.
+    Compressions of all lists are looked up once per report, and with variants the record also keeps
+    sizes of each of them, so every list takes its smallest sizes from the same record.
+    Cacheline minima are found once per page for each distinct set of compressions with cacheline sizes.
+
     By Yuqing Liu
     HEAP Lab, Virginia Tech 
     Nov 2019
@@ -16,90 +24,225 @@
 #include <inttypes.h>
 
 #include <plugin_struct.h>
-#define NAME_LIST {"bpc", "lz4"}
+#define NAME_LIST "bpc,lz4"     //default list, set another by -c best-of.list=name,name,...
 #define NAME "best-of"
-#define LIST_LEN (2)
+#define LIST_MAX (64)
+#define RECORDS (8)             //pages a thread can have in flight
+#define VARIANT_MAX (16)
 
 struct layout LAYOUT_NODE_NAME;
 struct compression COMPRESSION_NODE_NAME;
 
-char* name_list[] = NAME_LIST;
-struct compression * c_list[LIST_LEN];
+//smallest sizes of a page among compressions in list that reported it
+struct bo_record
+{
+    uint64_t index;     //page of record
+    uint64_t reported;  //bit of each compression in list that reported the page
+    uint16_t csize[PAGE_SIZE/CACHELINE_SIZE];
+    uint16_t cindex[PAGE_SIZE/CACHELINE_SIZE];
+    uint16_t psize;
+    uint16_t pindex;
+    uint16_t * vcsize;  //with variants, cacheline sizes of each compression in list
+    uint16_t * vpsize;  //with variants, page size of each compression in list
+    uint64_t lines;     //bit of each compression in list that reported cacheline sizes
+    uint64_t sum_mask[VARIANT_MAX];     //with variants, sums of cacheline minima already found for these masks
+    uint32_t sum[VARIANT_MAX];
+    int sums;
+};
+
+char ** name_list;
+int list_len;
+int base_len;           //compressions of best-of.list, the others come from variants only
+char * variant_sets[VARIANT_MAX];
+uint64_t variant_mask[VARIANT_MAX];     //compressions in list of each variant
+int variant_count;
+struct compression variant_node[VARIANT_MAX];
+char variant_name[VARIANT_MAX][32];
+struct compression ** c_list;
 int run;
-__thread int init = 0;
-__thread uint16_t csize[PAGE_SIZE/CACHELINE_SIZE];
-__thread uint16_t cindex[PAGE_SIZE/CACHELINE_SIZE];
-__thread uint16_t psize;
-__thread uint16_t pindex;
-uint64_t portion_report[LIST_LEN];
+//records are kept by page index, so pages can be reported in any order
+__thread struct bo_record * records;
+//cachelines won by each compression in list, merged in thread clean
+__thread uint64_t * thread_portion;
+uint64_t * portion_report;
 pthread_mutex_t rlock;
 
 static void bo_fr()
 {   return;}
 
 static void bo_tcr()
-{   return;}
+{
+    int i;
+    if (!run || thread_portion == NULL)
+        return;
+    pthread_mutex_lock(&rlock);
+    for (i = 0; i < list_len; i++)
+        portion_report[i] += thread_portion[i];
+    pthread_mutex_unlock(&rlock);
+    free(thread_portion);
+    for (i = 0; i < RECORDS && variant_count; i++)
+    {
+        free(records[i].vcsize);
+        free(records[i].vpsize);
+    }
+    free(records);
+    thread_portion = NULL;
+    records = NULL;
+}
+
+static uint64_t bo_variant_cp(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f);
+
+//index of name in list, added if not there. -1 if list is full
+static int bo_list_add(char * name)
+{
+    int i;
+    for (i = 0; i < list_len && strcmp(name_list[i], name); i++);
+    if (i == list_len && list_len < LIST_MAX)
+        name_list[list_len++] = name;
+    return i < LIST_MAX ? i : -1;
+}
+
+//adds compressions of every variant to list after those of best-of.list
+static void bo_variants_init()
+{
+    int i, j;
+    char * tok, * save;
+    variant_count = shared_variants(LAYOUT_NODE_NAME.sharedv, "best-of.variants", variant_sets, VARIANT_MAX);
+    for (i = 0; i < variant_count; i++)
+    {
+        char * copy = strdup(variant_sets[i]);
+        variant_mask[i] = 0;
+        for (tok = strtok_r(variant_sets[i], ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+            if ((j = bo_list_add(tok)) >= 0)
+                variant_mask[i] |= 1ull << j;
+        variant_sets[i] = copy;     //list as given, for the report
+        snprintf(variant_name[i], sizeof(variant_name[0]), NAME "#%d", i + 1);
+        memset(&variant_node[i], 0, sizeof(struct compression));
+        variant_node[i].name = variant_name[i];
+        variant_node[i].compress = (run_compression_t)bo_variant_cp;
+        variant_node[i].next = i + 1 < variant_count ? &variant_node[i + 1] : NULL;
+    }
+}
 
 //Initialize with latest matching string from list
 //allows taking data from other compression's result
 static void bo_init(struct compression ** c_p)
 {
     int i;
-    for (i = 0; i < LIST_LEN; i++)
+    char * list = shared_config(LAYOUT_NODE_NAME.sharedv, "best-of.list"), * tok, * save;
+    name_list = malloc(sizeof(char *) * LIST_MAX);
+    list_len = 0;
+    list = strdup(list != NULL ? list : NAME_LIST);
+    for (tok = strtok_r(list, ",", &save); tok != NULL && list_len < LIST_MAX; tok = strtok_r(NULL, ",", &save))
+        name_list[list_len++] = tok;
+    base_len = list_len;
+    char * variants = shared_config(LAYOUT_NODE_NAME.sharedv, "best-of.variants");
+    variant_count = 0;
+    if (variants != NULL)
+        bo_variants_init();
+    c_list = malloc(sizeof(struct compression *) * list_len);
+    for (i = 0; i < list_len; i++)
         c_list[i] = NULL;
     run = 0;
     if (*c_p == NULL)
         return;
     struct compression * p;
     for (p = *c_p; p != NULL; p = p ->next)
-        for (i = 0; i < LIST_LEN; i++)
+        for (i = 0; i < list_len; i++)
             if (!strcmp(p->name, name_list[i]))
                 c_list[i] = p;
-    for (i = 0; i < LIST_LEN; i++)
+    for (i = 0; i < base_len; i++)
         if (c_list[i] == NULL)
             return;
-    run = 1;
+    //variants with a compression not loaded report pages uncompressed
+    for (i = base_len; i < list_len; i++)
+        if (c_list[i] == NULL)
+        {
+            int v;
+            for (v = 0; v < variant_count; v++)
+                if (variant_mask[v] >> i & 1)
+                    variant_mask[v] = 0;
+        }
+    run = base_len > 0;
+    if (!run)
+        return;
     for (p = *c_p; p->next != NULL; p = p ->next);
     p->next = &COMPRESSION_NODE_NAME;
+    COMPRESSION_NODE_NAME.next = variant_count ? &variant_node[0] : NULL;
     LAYOUT_NODE_NAME.reports = &COMPRESSION_NODE_NAME;
-    LAYOUT_NODE_NAME.report_count = 1;
+    LAYOUT_NODE_NAME.report_count = 1 + variant_count;
     rlock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
-    for (i = 0; i < LIST_LEN; i++)
-        portion_report[i] = 0;
+    portion_report = calloc(list_len, sizeof(uint64_t));
     return;
 }
 
-static void bo_pr(struct compression * c_p, uint16_t * cl_list, uint16_t page_size)
+//record of page f, empty if the slot held another page
+static struct bo_record * bo_record(struct page_features * f)
 {
-    if (!run)
-        return;
-    int i, j;
-    if (!init)
+    int i;
+    if (records == NULL)
+    {
+        records = malloc(sizeof(struct bo_record) * RECORDS);
+        thread_portion = calloc(list_len, sizeof(uint64_t));
+        for (i = 0; i < RECORDS; i++)
+        {
+            records[i].index = UINT64_MAX;
+            records[i].vcsize = variant_count ? malloc(sizeof(uint16_t) * list_len * (PAGE_SIZE/CACHELINE_SIZE)) : NULL;
+            records[i].vpsize = variant_count ? malloc(sizeof(uint16_t) * list_len) : NULL;
+        }
+    }
+    struct bo_record * r = &records[f->index % RECORDS];
+    if (r->index != f->index)
     {
-        init = 1;
+        r->index = f->index;
+        r->reported = 0;
+        r->lines = 0;
+        r->sums = 0;
         for (i = 0; i < PAGE_SIZE/CACHELINE_SIZE; i++)
-            cindex[i] = LIST_LEN;
-        pindex = LIST_LEN;
+            r->cindex[i] = list_len;
+        r->pindex = list_len;
     }
-    for (i = 0; i < LIST_LEN; i++)
+    return r;
+}
+
+static void bo_pr(struct compression * c_p, uint16_t * cl_list, uint16_t page_size, struct page_features * f)
+{
+    if (!run)
+        return;
+    int i, j;
+    for (i = 0; i < list_len; i++)
         if (c_list[i] == c_p)
             break;
-    if (i >= LIST_LEN)
+    if (i >= list_len)
+        return;
+    struct bo_record * r = bo_record(f);
+    r->reported |= 1ull << i;
+    if (variant_count)
+    {
+        r->vpsize[i] = page_size;
+        if (cl_list != NULL)
+        {
+            r->lines |= 1ull << i;
+            for (j = 0; j < PAGE_SIZE/CACHELINE_SIZE; j++)
+                r->vcsize[i * (PAGE_SIZE/CACHELINE_SIZE) + j] = NORM_CACHELINE(cl_list[j]);
+        }
+    }
+    if (i >= base_len)
         return;
     if (cl_list != NULL)
     {
         for (j = 0; j < PAGE_SIZE/CACHELINE_SIZE; j++)
-            if (cindex[j] == LIST_LEN || csize[j] > NORM_CACHELINE(cl_list[j]))
+            if (r->cindex[j] == list_len || r->csize[j] > NORM_CACHELINE(cl_list[j]))
             {
-                csize[j] = NORM_CACHELINE(cl_list[j]);
-                cindex[j] = i;
+                r->csize[j] = NORM_CACHELINE(cl_list[j]);
+                r->cindex[j] = i;
             }
     }
     else
-        if (pindex == LIST_LEN || page_size < psize)
+        if (r->pindex == list_len || page_size < r->psize)
         {
-            pindex = i;
-            psize = page_size;
+            r->pindex = i;
+            r->psize = page_size;
         }
 }
 
@@ -110,45 +253,109 @@ static void bo_cr()
         return;
     pthread_mutex_destroy(&rlock);
     int i;
-    for (i = 0; i < LIST_LEN; i++)
+    for (i = 0; i < base_len; i++)
         printf("%s, ", name_list[i]);
     printf("\n");
-    for (i = 0; i < LIST_LEN; i++)
+    for (i = 0; i < base_len; i++)
         printf("%"PRIu64", ", portion_report[i]);
     printf("\n");
+    if (variant_count)
+    {
+        printf("best-of variants:");
+        for (i = 0; i < variant_count; i++)
+        {
+            printf("#%d=%s%s:", i + 1, variant_sets[i], variant_mask[i] ? "" : "(missing)");
+            free(variant_sets[i]);
+        }
+        printf("\n");
+    }
+    free(name_list[0]);
+    free(name_list);
+    free(c_list);
+    free(portion_report);
 }
 
-static uint64_t bo_cp(struct compression * c_p, uint8_t * start, uint16_t ** report)
+//runs after compressions in list reported the page
+static uint64_t bo_cp(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f)
 {
+    struct bo_record * r = bo_record(f);
     uint16_t cpsize = 0;
     int i;
+    if ((r->reported & ((1ull << base_len) - 1)) == 0)   //nothing reported, i.e. page was not compressed
+        return PAGE_SIZE * 8;
     for (i = 0; i < PAGE_SIZE/CACHELINE_SIZE; i++)
     {
-        cpsize += csize[i];
+        cpsize += r->csize[i];
     }
     uint64_t ret = 0;
-    if (pindex == LIST_LEN || (cindex[0] != LIST_LEN && cpsize < psize))
+    if (r->pindex == list_len || (r->cindex[0] != list_len && cpsize < r->psize))
     {
         ret = cpsize;
-        pthread_mutex_lock(&rlock);
         for (i = 0; i < PAGE_SIZE/CACHELINE_SIZE; i++)
-            portion_report[cindex[i]]++;
-        pthread_mutex_unlock(&rlock);
+            thread_portion[r->cindex[i]]++;
     }
     else
     {
-        ret = psize;
-        pthread_mutex_lock(&rlock);
-        portion_report[pindex] += PAGE_SIZE/CACHELINE_SIZE;
-        pthread_mutex_unlock(&rlock);
+        ret = r->psize;
+        thread_portion[r->pindex] += PAGE_SIZE/CACHELINE_SIZE;
     }
-    if (pindex == LIST_LEN)
+    if (r->pindex == list_len)
     {
         *report = calloc(sizeof(uint16_t), PAGE_SIZE / CACHELINE_SIZE);
         for (i = 0; i < PAGE_SIZE / CACHELINE_SIZE; i++)
-            (*report)[i] = csize[i];
+            (*report)[i] = r->csize[i];
+    }
+    if (!variant_count)
+        r->index = UINT64_MAX;
+    return ret;
+}
+
+//sum of smallest cacheline sizes among compressions in lines, found once per mask for each page
+static uint32_t bo_line_sum(struct bo_record * r, uint64_t lines)
+{
+    uint16_t m[PAGE_SIZE/CACHELINE_SIZE];
+    uint32_t sum = 0;
+    uint64_t rest;
+    int i, j;
+    for (i = 0; i < r->sums; i++)
+        if (r->sum_mask[i] == lines)
+            return r->sum[i];
+    memset(m, 0xff, sizeof(m));
+    for (rest = lines; rest; rest &= rest - 1)
+    {
+        uint16_t * s = r->vcsize + __builtin_ctzll(rest) * (PAGE_SIZE/CACHELINE_SIZE);
+        for (j = 0; j < PAGE_SIZE/CACHELINE_SIZE; j++)
+            if (s[j] < m[j])
+                m[j] = s[j];
+    }
+    for (j = 0; j < PAGE_SIZE/CACHELINE_SIZE; j++)
+        sum += m[j];
+    if (r->sums < VARIANT_MAX)
+    {
+        r->sum_mask[r->sums] = lines;
+        r->sum[r->sums++] = sum;
     }
-    init = 0;
+    return sum;
+}
+
+//smallest sizes among compressions of a variant, as bo_cp does for best-of.list
+static uint64_t bo_variant_cp(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f)
+{
+    struct bo_record * r = bo_record(f);
+    int v = c_p - variant_node;
+    uint64_t mask = variant_mask[v] & r->reported, ret = PAGE_SIZE * 8, rest;
+    uint32_t cpsize = 0, psize = UINT32_MAX;
+    if (mask & r->lines)
+        cpsize = bo_line_sum(r, mask & r->lines);
+    for (rest = mask & ~r->lines; rest; rest &= rest - 1)
+        if (r->vpsize[__builtin_ctzll(rest)] < psize)
+            psize = r->vpsize[__builtin_ctzll(rest)];
+    if (mask & r->lines && (psize == UINT32_MAX || cpsize < psize))
+        ret = cpsize;
+    else if (psize != UINT32_MAX)
+        ret = psize;
+    if (v == variant_count - 1)
+        r->index = UINT64_MAX;
     return ret;
 }
 
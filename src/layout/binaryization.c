@@ -4,6 +4,18 @@
 
     Determines how much of the compressed page/cacheline is within a certain size
 
+    bz reports pages of source within bound bytes as half pages, and other pages as uncompressed.
+    For every compression but reports that are not sizes, per-thread histograms of page and cacheline sizes in bits are kept
+    and merged when each thread exits, so any threshold is answered in the end from the same pass.
+    Histograms are given to compressions in list order at init. Reports of layouts initialized later
+    get theirs on first report, and results are printed in list order.
+    Options by -c:
+        binaryization.source=name           compression of bz, default best-of
+        binaryization.bound=bytes           bound of bz, default 3604
+        binaryization.thresholds=bytes,...  page thresholds to report, default 1024,2048,3072,3604
+        binaryization.line_thresholds=bytes,...  cacheline thresholds to report, default 8,16,32,48
+        binaryization.variants=bytes;...    more bounds of bz, each reported as bz#n from the same page of source
+
     By Yuqing Liu
     HEAP Lab, Virginia Tech 
     Jun 2019
@@ -16,30 +28,111 @@
 #include <plugin_struct.h>
 
 struct layout LAYOUT_NODE_NAME;
-
+struct compression COMPRESSION_NODE_NAME;
 
 #define PAGE_B (3604*8)
 #define CL_B (CACHELINE_SIZE*8)
+#define BZ_MAX (64)             //compressions with histograms
+#define BZ_THRESHOLDS (32)
+#define PAGE_BITS (PAGE_SIZE * 8)
+#define VARIANT_MAX (16)
 
-#define PAGE_CALC(a) (a > PAGE_B ? PAGE_SIZE * 8 : PAGE_SIZE * 4)
+#define PAGE_CALC(a) (a > page_b ? PAGE_SIZE * 8 : PAGE_SIZE * 4)
 //#define CL_CALC(a) (NORM_CACHELINE(a) > CL_B ? CACHELINE_SIZE * 8 : CACHELINE_SIZE * 4)
 
 #define interest "best-of"
 
-static uint64_t bz_cp(struct compression * c_p, uint8_t * start, uint16_t ** report);
+static uint64_t bz_cp(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f);
 __thread uint64_t pgs;
+__thread uint16_t source_size;
+static char * source;
+static uint64_t page_b;
+static char * variant_sets[VARIANT_MAX];
+static uint64_t variant_b[VARIANT_MAX];
+static int variant_count;
+static struct compression variant_node[VARIANT_MAX];
+static char variant_name[VARIANT_MAX][32];
+
+//compressions with histograms, in list order then in order of first report. Printed in bz_order
+static struct compression * bz_c[BZ_MAX];
+static int bz_count;
+static int bz_order[BZ_MAX];
+static pthread_mutex_t bz_lock;
+//histograms of sizes in bits, sizes above the last bucket are in it
+static uint64_t * page_hist[BZ_MAX];
+static uint64_t * line_hist[BZ_MAX];
+__thread uint32_t * thread_page_hist[BZ_MAX];
+__thread uint32_t * thread_line_hist[BZ_MAX];
+
+static int thresholds[BZ_THRESHOLDS], line_thresholds[BZ_THRESHOLDS];
+static int threshold_count, line_threshold_count;
+
+//reads comma separated list of bytes
+static int bz_list(char * key, char * value, int * list)
+{
+    char * v = shared_config(LAYOUT_NODE_NAME.sharedv, key);
+    char * copy = strdup(v != NULL ? v : value), * tok, * save;
+    int count = 0;
+    for (tok = strtok_r(copy, ",", &save); tok != NULL && count < BZ_THRESHOLDS; tok = strtok_r(NULL, ",", &save))
+        list[count++] = strtol(tok, NULL, 0);
+    free(copy);
+    return count;
+}
+
+//orders histograms by the list, which is complete by now
+static void bz_fr(struct compression * c_p, uint64_t totalpages)
+{
+    int i, n = 0;
+    for (; c_p != NULL; c_p = c_p->next)
+        for (i = 0; i < bz_count; i++)
+            if (bz_c[i] == c_p)
+                bz_order[n++] = i;
+}
+
+static uint64_t bz_variant_cp(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f)
+{
+    return source_size > variant_b[c_p - variant_node] ? PAGE_SIZE * 8 : PAGE_SIZE * 4;
+}
 
-static void bz_fr()
-{   return;}
+//gives compression histograms. Call with bz_lock held or before threads start
+static void bz_add(struct compression * c_p)
+{
+    bz_c[bz_count] = c_p;
+    page_hist[bz_count] = calloc(PAGE_BITS + 1, sizeof(uint64_t));
+    line_hist[bz_count] = calloc(CL_B + 1, sizeof(uint64_t));
+    __atomic_store_n(&bz_count, bz_count + 1, __ATOMIC_RELEASE);
+}
 
 static void bz_init(struct compression ** c_p)
 {
+    char * v;
+    int i;
+    source = shared_config(LAYOUT_NODE_NAME.sharedv, "binaryization.source");
+    source = source != NULL ? source : interest;
+    page_b = (v = shared_config(LAYOUT_NODE_NAME.sharedv, "binaryization.bound")) != NULL ? strtol(v, NULL, 0) * 8 : PAGE_B;
+    threshold_count = bz_list("binaryization.thresholds", "1024,2048,3072,3604", thresholds);
+    line_threshold_count = bz_list("binaryization.line_thresholds", "8,16,32,48", line_thresholds);
+    bz_count = 0;
+    bz_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+    variant_count = shared_variants(LAYOUT_NODE_NAME.sharedv, "binaryization.variants", variant_sets, VARIANT_MAX);
+    for (i = 0; i < variant_count; i++)
+    {
+        variant_b[i] = strtol(variant_sets[i], NULL, 0) * 8;
+        snprintf(variant_name[i], sizeof(variant_name[0]), "bz#%d", i + 1);
+        memset(&variant_node[i], 0, sizeof(struct compression));
+        variant_node[i].name = variant_name[i];
+        variant_node[i].compress = (run_compression_t)bz_variant_cp;
+        variant_node[i].next = i + 1 < variant_count ? &variant_node[i + 1] : NULL;
+    }
+    COMPRESSION_NODE_NAME.next = variant_count ? &variant_node[0] : NULL;
+    LAYOUT_NODE_NAME.report_count = 1 + variant_count;
     if (*c_p == NULL)
         return;
-    int i;
     struct compression * cp = *c_p;
     for (i = 0; ; cp = cp->next)
     {
+        if (bz_count < BZ_MAX && !cp->not_size)
+            bz_add(cp);
         if (cp->next == NULL)
         {
             cp->next = LAYOUT_NODE_NAME.reports;
@@ -49,24 +142,120 @@ static void bz_init(struct compression ** c_p)
     }
 }
 
-static void bz_pr(struct compression * c_p, uint16_t * cl_list, uint16_t page_size)
+//index of compression in histograms, added on first report if it joined the list after init. -1 if there is no room
+static int bz_index(struct compression * c_p)
+{
+    int i, count = __atomic_load_n(&bz_count, __ATOMIC_ACQUIRE);
+    for (i = 0; i < count; i++)
+        if (bz_c[i] == c_p)
+            return i;
+    pthread_mutex_lock(&bz_lock);
+    for (i = 0; i < bz_count && bz_c[i] != c_p; i++);
+    if (i == bz_count && i < BZ_MAX)
+        bz_add(c_p);
+    pthread_mutex_unlock(&bz_lock);
+    return i < BZ_MAX ? i : -1;
+}
+
+static void bz_pr(struct compression * c_p, uint16_t * cl_list, uint16_t page_size, struct page_features * f)
 {
-    if (!strcmp(c_p->name, interest))
+    if (!strcmp(c_p->name, source))
+    {
         pgs = PAGE_CALC(page_size);
+        source_size = page_size;
+    }
+    if (c_p == &COMPRESSION_NODE_NAME || (c_p >= variant_node && c_p < variant_node + variant_count) || c_p->not_size)
+        return;
+    int i, j = bz_index(c_p);
+    if (j < 0)
+        return;
+    if (thread_page_hist[j] == NULL)
+    {
+        thread_page_hist[j] = calloc(PAGE_BITS + 1, sizeof(uint32_t));
+        thread_line_hist[j] = calloc(CL_B + 1, sizeof(uint32_t));
+    }
+    thread_page_hist[j][page_size > PAGE_BITS ? PAGE_BITS : page_size]++;
+    if (cl_list != NULL)
+        for (i = 0; i < PAGE_SIZE / CACHELINE_SIZE; i++)
+        {
+            uint16_t s = IS_ZERO_CACHELINE(cl_list[i]) ? 0 : cl_list[i];
+            thread_line_hist[j][s > CL_B ? CL_B : s]++;
+        }
 }
 
-static uint64_t bz_cp(struct compression * c_p, uint8_t * start, uint16_t ** report)
+static uint64_t bz_cp(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f)
 {
     return pgs;
 }
 
 static void bz_tcr()
 {
-    return;
+    int i, j;
+    pthread_mutex_lock(&bz_lock);
+    for (j = 0; j < bz_count; j++)
+    {
+        if (thread_page_hist[j] == NULL)
+            continue;
+        for (i = 0; i <= PAGE_BITS; i++)
+            page_hist[j][i] += thread_page_hist[j][i];
+        for (i = 0; i <= CL_B; i++)
+            line_hist[j][i] += thread_line_hist[j][i];
+        free(thread_page_hist[j]);
+        free(thread_line_hist[j]);
+        thread_page_hist[j] = thread_line_hist[j] = NULL;
+    }
+    pthread_mutex_unlock(&bz_lock);
+}
+
+/*
+    Prints share of units within each threshold, and ratio if those units take the threshold
+    and the others are stored uncompressed. Histograms become cumulative.
+*/
+static void bz_print(char * unit, uint64_t ** hist, int bits, int * list, int count)
+{
+    int i, j, t;
+    for (j = 0; j < bz_count; j++)
+        for (i = 1; i <= bits; i++)
+            hist[j][i] += hist[j][i - 1];
+    for (t = 0; t < count; t++)
+    {
+        int b = list[t] * 8 > bits ? bits : list[t] * 8;
+        int printed = 0, o;
+        for (o = 0; o < bz_count; o++)
+        {
+            j = bz_order[o];
+            uint64_t total = hist[j][bits], fit = hist[j][b];
+            if (total == 0)
+                continue;
+            if (!printed++)
+                printf("binaryization %s within %d bytes(share:ratio):", unit, list[t]);
+            printf("%s=%lf:%lf:", bz_c[j]->name, fit / (double)total,
+                total * (double)bits / (fit * (double)b + (total - fit) * (double)bits));
+        }
+        if (printed)
+            printf("\n");
+    }
 }
 
 static void bz_cr()
 {
+    int j;
+    bz_print("pages", page_hist, PAGE_BITS, thresholds, threshold_count);
+    bz_print("cachelines", line_hist, CL_B, line_thresholds, line_threshold_count);
+    if (variant_count)
+    {
+        printf("bz variants:");
+        for (j = 0; j < variant_count; j++)
+            printf("#%d=%s:", j + 1, variant_sets[j]);
+        printf("\n");
+        free(variant_sets[0]);
+    }
+    for (j = 0; j < bz_count; j++)
+    {
+        free(page_hist[j]);
+        free(line_hist[j]);
+    }
+    pthread_mutex_destroy(&bz_lock);
     return;
 }
 
@@ -87,4 +276,4 @@ struct layout LAYOUT_NODE_NAME = {
     .reports = &COMPRESSION_NODE_NAME,
     .report_count = 1,
     .priority = -2
-};
\ No newline at end of file
+};
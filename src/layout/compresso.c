@@ -5,6 +5,24 @@
     Implemented based on paper:
     lph.ece.utexas.edu/merez/uploads/MattanErez/micro18_compresso.pdf
 
+    Counts are kept per thread and merged when each thread exits.
+    Cacheline and page sizes are mapped to their buckets by tables built at init.
+
+    The dynamic part is simulated if writes are given by -c options:
+        compresso.dump=file         second dump. Cachelines that differ from the first dump are written
+        compresso.trace=file        text lines of "page line size", page index in measured part of dump,
+                                    cacheline index and new compressed size in bits. Replayed after compresso.dump
+        compresso.inflation=count   inflated lines a page can point to, default 17
+        compresso.variants=lines/pages;...  more cacheline and page size sets, each reported as compresso#n
+                                    and compresso_cache#n, i.e. 0,16,32,64/1024,2048,3072,4096. Sizes in bytes, ascending.
+                                    Either part can be left empty for the default set
+    Starting from the static layout of a page, a written line that grows past its bucket overflows.
+    It is moved to the inflation room at the end of the page if there is room and a free pointer,
+    otherwise the page is repacked, and grows to a larger page size if the lines do not fit.
+    Pages are replayed by the thread that compressed them. Writes to zero pages are not measured.
+    Variants are evaluated from the same cacheline reports. Lines of a page are counted once by the union
+    of cacheline sizes of all variants, so a variant costs one pass over the union instead of over the lines.
+
     By Yuqing Liu
     HEAP Lab, Virginia Tech 
     Jun 2019
@@ -15,11 +33,13 @@
 #include <string.h>
 
 #include <plugin_struct.h>
+#include <dump.h>
 
 #define COMPRESSONAME "bpc_compresso"
 
 struct layout LAYOUT_NODE_NAME;
 struct compression COMPRESSION_NODE_NAME;
+struct compression Compreeso_Cache;
 
 const static uint8_t allowed_cacheline_sizes [] = {0, 8, 32, 64};
 #define allowed_cacheline_sizes_len 4
@@ -34,12 +54,197 @@ static uint64_t raw_cacheline_size[allowed_cacheline_sizes_len];
 static uint64_t raw_page_size[allowed_page_sizes_len];
 static uint64_t raw_page_size_aligned[allowed_page_sizes_len];
 
-static pthread_mutex_t raw_cacheline_lock[allowed_cacheline_sizes_len];
-static pthread_mutex_t raw_page_lock[allowed_page_sizes_len];
+static pthread_mutex_t raw_lock;
+
+//bucket of cacheline size in bits, sizes larger than the table are in the last bucket
+static uint8_t cacheline_bucket[CACHELINE_SIZE * 8 + 1];
+//bucket of aligned page size in bytes, by 8 bytes
+static uint8_t page_bucket[PAGE_SIZE / 8 + 1];
+
+__thread uint64_t thread_cacheline_count[allowed_cacheline_sizes_len];
+__thread uint64_t thread_cacheline_size[allowed_cacheline_sizes_len];
+__thread uint64_t thread_page_count[allowed_page_sizes_len];
+__thread uint64_t thread_page_size[allowed_page_sizes_len];
+__thread uint64_t thread_page_size_aligned[allowed_page_sizes_len];
 
 __thread uint32_t psize;
 __thread uint32_t psizealigned;
 
+//variants
+#define VARIANT_MAX (16)
+#define VARIANT_SIZES (16)
+#define LINE_UNION (VARIANT_MAX * VARIANT_SIZES)
+
+struct compresso_variant
+{
+    char * set;
+    uint8_t line_sizes[VARIANT_SIZES];
+    uint16_t page_sizes[VARIANT_SIZES];
+    int line_len, page_len;
+    uint8_t union_size[LINE_UNION];     //bytes of a line in each union bucket
+    uint8_t page_bucket[PAGE_SIZE / 8 + 1];
+};
+
+static struct compresso_variant variant[VARIANT_MAX];
+static int variant_count;
+static char * variant_sets[VARIANT_MAX];
+static struct compression variant_node[VARIANT_MAX * 2];
+static char variant_name[VARIANT_MAX * 2][32];
+static uint8_t line_union[LINE_UNION];      //cacheline sizes of all variants, ascending
+static int line_union_len;
+static uint8_t union_bucket[CACHELINE_SIZE * 8 + 1];
+__thread uint32_t variant_psize[VARIANT_MAX];
+__thread uint32_t variant_psizealigned[VARIANT_MAX];
+
+//dynamic simulation
+struct compresso_event
+{
+    uint64_t page;
+    uint16_t line;
+    uint16_t size;      //in bits
+};
+
+enum {DYN_PAGES, DYN_WRITES, DYN_LINE_OVERFLOW, DYN_INFLATED, DYN_REPACK, DYN_PAGE_OVERFLOW, DYN_SIZE, DYN_REPACKED_SIZE, DYN_COUNT};
+
+static int dynamic;
+static uint8_t * second_dump;
+static uint64_t second_dump_pages;
+static struct compresso_event * trace;      //sorted by page, in order of trace within page
+static uint64_t * trace_offset;             //writes of page i are trace_offset[i] to trace_offset[i + 1]
+static int inflated_max;
+static uint64_t dyn[DYN_COUNT];
+__thread uint64_t thread_dyn[DYN_COUNT];
+
+//metadata and line sizes of a page being replayed
+struct compresso_page
+{
+    uint16_t size[PAGE_SIZE / CACHELINE_SIZE];      //in bits, 0 for zero lines
+    uint8_t bucket[PAGE_SIZE / CACHELINE_SIZE];
+    uint8_t inflated[PAGE_SIZE / CACHELINE_SIZE];
+    int inflated_count;
+    int packed;         //bytes of lines in their buckets
+    int allocated;      //bytes of page, without metadata
+};
+
+//reads trace and sorts it by page. Returns 0 on error
+static int compresso_load_trace(char * fn, uint64_t pages)
+{
+    FILE * tf = fopen(fn, "r");
+    if (tf == NULL)
+        return 0;
+    uint64_t count = 0, cap = 1024, i, page;
+    unsigned line, size;
+    struct compresso_event * w = malloc(sizeof(struct compresso_event) * cap);
+    while (fscanf(tf, "%"SCNu64" %u %u", &page, &line, &size) == 3)
+    {
+        if (page >= pages || line >= PAGE_SIZE / CACHELINE_SIZE)
+            continue;
+        if (count == cap)
+            w = realloc(w, sizeof(struct compresso_event) * (cap *= 2));
+        w[count].page = page;
+        w[count].line = line;
+        w[count++].size = size;
+    }
+    fclose(tf);
+    //counting sort keeps order of writes to a page
+    trace_offset = calloc(pages + 1, sizeof(uint64_t));
+    for (i = 0; i < count; i++)
+        trace_offset[w[i].page + 1]++;
+    for (i = 0; i < pages; i++)
+        trace_offset[i + 1] += trace_offset[i];
+    uint64_t * next = malloc(sizeof(uint64_t) * pages);
+    memcpy(next, trace_offset, sizeof(uint64_t) * pages);
+    trace = malloc(sizeof(struct compresso_event) * (count + 1));
+    for (i = 0; i < count; i++)
+        trace[next[w[i].page]++] = w[i];
+    free(next);
+    free(w);
+    return 1;
+}
+
+static uint64_t compresso_variant_cp(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f);
+
+//reads ascending sizes separated by commas from s to end. Returns count, 0 if none
+static int compresso_sizes(char * s, char * end, int * sizes, int max)
+{
+    int count = 0;
+    while (s < end && count < max)
+    {
+        char * next;
+        int x = strtol(s, &next, 0);
+        if (next == s)
+            break;
+        if (count == 0 || x > sizes[count - 1])
+            sizes[count++] = x;
+        s = *next == ',' ? next + 1 : next;
+    }
+    return count;
+}
+
+//parses compresso.variants and builds bucket tables of each variant and of the union of cacheline sizes
+static void compresso_variants_init()
+{
+    int i, j, k, sizes[VARIANT_SIZES];
+    variant_count = shared_variants(LAYOUT_NODE_NAME.sharedv, "compresso.variants", variant_sets, VARIANT_MAX);
+    line_union_len = 0;
+    for (i = 0; i < variant_count; i++)
+    {
+        struct compresso_variant * v = &variant[i];
+        char * slash = strchr(variant_sets[i], '/'), * end = variant_sets[i] + strlen(variant_sets[i]);
+        v->set = variant_sets[i];
+        v->line_len = compresso_sizes(variant_sets[i], slash != NULL ? slash : end, sizes, VARIANT_SIZES);
+        for (j = 0; j < v->line_len; j++)
+            v->line_sizes[j] = sizes[j] > CACHELINE_SIZE ? CACHELINE_SIZE : sizes[j];
+        if (v->line_len == 0)
+            memcpy(v->line_sizes, allowed_cacheline_sizes, v->line_len = allowed_cacheline_sizes_len);
+        v->page_len = slash != NULL ? compresso_sizes(slash + 1, end, sizes, VARIANT_SIZES) : 0;
+        for (j = 0; j < v->page_len; j++)
+            v->page_sizes[j] = sizes[j];
+        if (v->page_len == 0)
+            memcpy(v->page_sizes, allowed_page_sizes, sizeof(uint16_t) * (v->page_len = allowed_page_sizes_len));
+        for (j = 0; j <= PAGE_SIZE / 8; j++)
+        {
+            for (k = 0; k < v->page_len - 1 && j * 8 >= v->page_sizes[k]; k++);
+            v->page_bucket[j] = k;
+        }
+        //union of line sizes, kept ascending
+        for (j = 0; j < v->line_len; j++)
+        {
+            for (k = 0; k < line_union_len && line_union[k] < v->line_sizes[j]; k++);
+            if (k < line_union_len && line_union[k] == v->line_sizes[j])
+                continue;
+            memmove(line_union + k + 1, line_union + k, line_union_len++ - k);
+            line_union[k] = v->line_sizes[j];
+        }
+    }
+    for (i = 0; i <= CACHELINE_SIZE * 8; i++)
+    {
+        for (j = 0; j < line_union_len - 1 && i > line_union[j] * 8; j++);
+        union_bucket[i] = j;
+    }
+    //a line in union bucket j takes the smallest size of the variant holding that union size
+    for (i = 0; i < variant_count; i++)
+        for (j = 0; j < line_union_len; j++)
+        {
+            for (k = 0; k < variant[i].line_len - 1 && line_union[j] > variant[i].line_sizes[k]; k++);
+            variant[i].union_size[j] = variant[i].line_sizes[k];
+        }
+    for (i = 0; i < variant_count; i++)
+    {
+        snprintf(variant_name[i * 2], sizeof(variant_name[0]), "compresso#%d", i + 1);
+        snprintf(variant_name[i * 2 + 1], sizeof(variant_name[0]), "compresso_cache#%d", i + 1);
+        for (j = i * 2; j < i * 2 + 2; j++)
+        {
+            memset(&variant_node[j], 0, sizeof(struct compression));
+            variant_node[j].name = variant_name[j];
+            variant_node[j].compress = (run_compression_t)compresso_variant_cp;
+            variant_node[j].next = j + 1 < variant_count * 2 ? &variant_node[j + 1] : NULL;
+        }
+    }
+    Compreeso_Cache.next = variant_count ? &variant_node[0] : NULL;
+    LAYOUT_NODE_NAME.report_count += variant_count * 2;
+}
+
 static void compresso_init(struct compression ** c_p)
 {
     LAYOUT_NODE_NAME.report_count = 0;
@@ -58,25 +263,159 @@ static void compresso_init(struct compression ** c_p)
     }
     if (LAYOUT_NODE_NAME.report_count)
     {
-        int i;
+        int i, j;
+        raw_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
         for (i = 0; i < allowed_cacheline_sizes_len ; i++)
         {
-            raw_cacheline_lock[i] = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
             raw_cacheline_size[i] = 0;
             raw_cacheline_count[i] = 0;
         }
         for (i = 0; i < allowed_page_sizes_len ; i++)
         {
-            raw_page_lock[i] = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
             raw_page_size[i] = 0;
             raw_page_count[i] = 0;
             raw_page_size_aligned[i] = 0;
         }
+        //smallest size that holds it
+        for (i = 0; i <= CACHELINE_SIZE * 8; i++)
+        {
+            for (j = 0; j < allowed_cacheline_sizes_len - 1 && i > allowed_cacheline_sizes[j] * 8; j++);
+            cacheline_bucket[i] = j;
+        }
+        //smallest size larger than it
+        for (i = 0; i <= PAGE_SIZE / 8; i++)
+        {
+            for (j = 0; j < allowed_page_sizes_len - 1 && i * 8 >= allowed_page_sizes[j]; j++);
+            page_bucket[i] = j;
+        }
+        char * fn = shared_config(LAYOUT_NODE_NAME.sharedv, "compresso.dump");
+        char * inflation = shared_config(LAYOUT_NODE_NAME.sharedv, "compresso.inflation");
+        inflated_max = inflation != NULL ? strtol(inflation, NULL, 0) : 17;
+        second_dump = NULL;
+        trace = NULL;
+        if (fn != NULL && (second_dump = dump_map(fn, &second_dump_pages)) == NULL)
+            printf("compresso: cannot open %s\n", fn);
+        fn = shared_config(LAYOUT_NODE_NAME.sharedv, "compresso.trace");
+        if (fn != NULL && !compresso_load_trace(fn, LAYOUT_NODE_NAME.sharedv->totalpages))
+            printf("compresso: cannot open %s\n", fn);
+        dynamic = second_dump != NULL || trace != NULL;
+        memset(dyn, 0, sizeof(dyn));
+        compresso_variants_init();
     }
     return;
 }
 
-static void compresso_pr(struct compression * c_p, uint16_t * cl_list, uint16_t page_size)
+static int compresso_line_bucket(uint16_t size)
+{
+    return cacheline_bucket[size > CACHELINE_SIZE * 8 ? CACHELINE_SIZE * 8 : size];
+}
+
+//smallest page size larger than packed lines
+static int compresso_page_allocation(int packed)
+{
+    return allowed_page_sizes[page_bucket[packed / 8]];
+}
+
+static void compresso_repack(struct compresso_page * s)
+{
+    int i;
+    s->packed = 0;
+    s->inflated_count = 0;
+    for (i = 0; i < PAGE_SIZE / CACHELINE_SIZE; i++)
+    {
+        s->bucket[i] = compresso_line_bucket(s->size[i]);
+        s->inflated[i] = 0;
+        s->packed += allowed_cacheline_sizes[s->bucket[i]];
+    }
+}
+
+static void compresso_write(struct compresso_page * s, int line, uint16_t size)
+{
+    thread_dyn[DYN_WRITES]++;
+    s->size[line] = size;
+    if (s->inflated[line] || compresso_line_bucket(size) <= s->bucket[line])
+        return;
+    thread_dyn[DYN_LINE_OVERFLOW]++;
+    if (s->inflated_count < inflated_max && s->allocated - s->packed - s->inflated_count * CACHELINE_SIZE >= CACHELINE_SIZE)
+    {
+        s->inflated[line] = 1;
+        s->inflated_count++;
+        thread_dyn[DYN_INFLATED]++;
+        return;
+    }
+    thread_dyn[DYN_REPACK]++;
+    compresso_repack(s);
+    if (compresso_page_allocation(s->packed) > s->allocated)
+    {
+        thread_dyn[DYN_PAGE_OVERFLOW]++;
+        s->allocated = compresso_page_allocation(s->packed);
+    }
+}
+
+//replays writes to page from second dump and trace, starting from static layout in cl_list
+static void compresso_replay(struct compression * c_p, uint16_t * cl_list, struct page_features * f)
+{
+    struct compresso_page s;
+    uint64_t i;
+    for (i = 0; i < PAGE_SIZE / CACHELINE_SIZE; i++)
+        s.size[i] = IS_ZERO_CACHELINE(cl_list[i]) ? 0 : cl_list[i];
+    compresso_repack(&s);
+    s.allocated = compresso_page_allocation(s.packed);
+    if (second_dump != NULL && f->index < second_dump_pages)
+    {
+        uint8_t * page = second_dump + f->index * PAGE_SIZE;
+        struct page_features * nf = calloc(1, sizeof(struct page_features));
+        uint16_t * report = NULL;
+        nf->data = page;
+        nf->index = f->index;
+        for (i = 0; i < PAGE_SIZE / CACHELINE_SIZE; i++)
+        {
+            int j;
+            for (j = 0; j < CACHELINE_SIZE && page[i * CACHELINE_SIZE + j] == 0; j++);
+            nf->zero_line[i] = j == CACHELINE_SIZE;
+        }
+        c_p->compress(c_p, page, &report, nf);
+        if (report != NULL)
+            for (i = 0; i < PAGE_SIZE / CACHELINE_SIZE; i++)
+                if (memcmp(page + i * CACHELINE_SIZE, f->data + i * CACHELINE_SIZE, CACHELINE_SIZE))
+                    compresso_write(&s, i, nf->zero_line[i] ? 0 : report[i]);
+        free(report);
+        free(nf);
+    }
+    if (trace != NULL)
+        for (i = trace_offset[f->index]; i < trace_offset[f->index + 1]; i++)
+            compresso_write(&s, trace[i].line, trace[i].size);
+    int allocated = s.allocated;
+    compresso_repack(&s);
+    thread_dyn[DYN_PAGES]++;
+    thread_dyn[DYN_SIZE] += (allocated + 64) * 8;
+    thread_dyn[DYN_REPACKED_SIZE] += (compresso_page_allocation(s.packed) + 64) * 8;
+}
+
+//sizes of page in every variant, from lines counted by union bucket
+static void compresso_variants_pr(uint16_t * cl_list)
+{
+    int i, j, zero = 0;
+    uint8_t count[LINE_UNION] = {0};
+    for (i = 0; i < PAGE_SIZE / CACHELINE_SIZE; i++)
+    {
+        if (IS_ZERO_CACHELINE(cl_list[i]))
+            zero++;
+        else
+            count[union_bucket[cl_list[i] > CACHELINE_SIZE * 8 ? CACHELINE_SIZE * 8 : cl_list[i]]]++;
+    }
+    for (i = 0; i < variant_count; i++)
+    {
+        struct compresso_variant * v = &variant[i];
+        uint32_t packed = zero * v->line_sizes[0];
+        for (j = 0; j < line_union_len; j++)
+            packed += count[j] * v->union_size[j];
+        variant_psize[i] = (v->page_sizes[v->page_bucket[packed / 8]] + 64) * 8;
+        variant_psizealigned[i] = packed * 8;
+    }
+}
+
+static void compresso_pr(struct compression * c_p, uint16_t * cl_list, uint16_t page_size, struct page_features * f)
 {   
     if (!LAYOUT_NODE_NAME.report_count || !!strcmp(c_p->name, COMPRESSONAME))
         return;
@@ -84,28 +423,25 @@ static void compresso_pr(struct compression * c_p, uint16_t * cl_list, uint16_t
     psizealigned = 0;
     for (i = 0; i < PAGE_SIZE / CACHELINE_SIZE; i++)
     {
-        for (j = 0; j < allowed_cacheline_sizes_len; j++)
-            if (IS_ZERO_CACHELINE(cl_list[i]) || cl_list[i] <= allowed_cacheline_sizes[j] * 8)
-                break;
-        j = j == allowed_cacheline_sizes_len ? j - 1 : j;
+        if (IS_ZERO_CACHELINE(cl_list[i]))
+            j = 0;
+        else
+            j = cacheline_bucket[cl_list[i] > CACHELINE_SIZE * 8 ? CACHELINE_SIZE * 8 : cl_list[i]];
         psizealigned += allowed_cacheline_sizes[j];
-        pthread_mutex_lock(&(raw_cacheline_lock[j]));
-        raw_cacheline_count[j]++;
-        raw_cacheline_size[j] += NORM_CACHELINE(cl_list[i]);
-        pthread_mutex_unlock(&(raw_cacheline_lock[j]));
+        thread_cacheline_count[j]++;
+        thread_cacheline_size[j] += NORM_CACHELINE(cl_list[i]);
     }
-    for (j = 0; j <= allowed_page_sizes_len; j++)
-        if (psizealigned < allowed_page_sizes[j])
-            break;
-    j = j == allowed_page_sizes_len ? j - 1 : j;
+    j = page_bucket[psizealigned / 8];
     psize = allowed_page_sizes[j] + 64;
     psize *= 8;
     psizealigned *= 8;
-    pthread_mutex_lock(&(raw_page_lock[j]));
-    raw_page_count[j]++;
-    raw_page_size[j] += page_size;
-    raw_page_size_aligned[j] += psizealigned;
-    pthread_mutex_unlock(&(raw_page_lock[j]));
+    thread_page_count[j]++;
+    thread_page_size[j] += page_size;
+    thread_page_size_aligned[j] += psizealigned;
+    if (dynamic)
+        compresso_replay(c_p, cl_list, f);
+    if (variant_count)
+        compresso_variants_pr(cl_list);
     return;
 }
 
@@ -113,7 +449,31 @@ static void compresso_fr(struct compression * begin_of_linked_list, uint64_t tot
 {   return; }
 
 static void compresso_tcr()
-{   return; }
+{
+    if (!LAYOUT_NODE_NAME.report_count)
+        return;
+    int i;
+    pthread_mutex_lock(&raw_lock);
+    for (i = 0; i < allowed_cacheline_sizes_len ; i++)
+    {
+        raw_cacheline_count[i] += thread_cacheline_count[i];
+        raw_cacheline_size[i] += thread_cacheline_size[i];
+        thread_cacheline_count[i] = thread_cacheline_size[i] = 0;
+    }
+    for (i = 0; i < allowed_page_sizes_len ; i++)
+    {
+        raw_page_count[i] += thread_page_count[i];
+        raw_page_size[i] += thread_page_size[i];
+        raw_page_size_aligned[i] += thread_page_size_aligned[i];
+        thread_page_count[i] = thread_page_size[i] = thread_page_size_aligned[i] = 0;
+    }
+    for (i = 0; i < DYN_COUNT; i++)
+    {
+        dyn[i] += thread_dyn[i];
+        thread_dyn[i] = 0;
+    }
+    pthread_mutex_unlock(&raw_lock);
+}
 
 static void compresso_cr()
 {
@@ -123,9 +483,9 @@ static void compresso_cr()
         printf("Cache count:");
         uint64_t total1, total2, total3, total4;
         total1 = total2 = total3 = 0;
+        pthread_mutex_destroy(&raw_lock);
         for (i = 0; i < allowed_cacheline_sizes_len ; i++)
         {
-            pthread_mutex_destroy(&raw_cacheline_lock[i]);
             printf("%lu:", raw_cacheline_count[i]);
             total1 += raw_cacheline_size[i];
             total2 += raw_cacheline_count[i] * allowed_cacheline_sizes[i] * 8;
@@ -142,7 +502,6 @@ static void compresso_cr()
         total1 = total2 = total3 = total4 = 0;
         for (i = 0; i < allowed_page_sizes_len ; i++)
         {
-            pthread_mutex_destroy(&raw_page_lock[i]);
             printf("%lu:", raw_page_count[i]);
             total1 += raw_page_size[i];
             total2 += raw_page_size_aligned[i];
@@ -163,20 +522,43 @@ static void compresso_cr()
         for (i = 0; i < allowed_page_sizes_len ; i++)
             printf("%lf:", (raw_page_count[i] * allowed_page_sizes[i] * 8) / (double)raw_page_size_aligned[i]);
         printf("\n");
+        if (dynamic)
+        {
+            printf("Compresso dynamic:pages=%"PRIu64":writes=%"PRIu64":line overflow=%"PRIu64":inflated=%"PRIu64":repack=%"PRIu64":page overflow=%"PRIu64,
+                dyn[DYN_PAGES], dyn[DYN_WRITES], dyn[DYN_LINE_OVERFLOW], dyn[DYN_INFLATED], dyn[DYN_REPACK], dyn[DYN_PAGE_OVERFLOW]);
+            printf(":ratio=%lf:repacked ratio=%lf\n", dyn[DYN_PAGES] * PAGE_SIZE * 8 / (double)dyn[DYN_SIZE],
+                dyn[DYN_PAGES] * PAGE_SIZE * 8 / (double)dyn[DYN_REPACKED_SIZE]);
+            free(trace);
+            free(trace_offset);
+        }
+        if (variant_count)
+        {
+            printf("Compresso variants:");
+            for (i = 0; i < variant_count; i++)
+                printf("#%d=%s:", i + 1, variant[i].set);
+            printf("\n");
+            free(variant_sets[0]);
+        }
     }
     return;
 }
 
-static uint64_t compresso_cp(struct compression * c_p, uint8_t * start, uint16_t ** report)
+static uint64_t compresso_cp(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f)
 {
     return psize;
 }
 
-static uint64_t compresso_cp2(struct compression * c_p, uint8_t * start, uint16_t ** report)
+static uint64_t compresso_cp2(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f)
 {
     return psizealigned;
 }
 
+static uint64_t compresso_variant_cp(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f)
+{
+    int i = c_p - variant_node;
+    return i % 2 ? variant_psizealigned[i / 2] : variant_psize[i / 2];
+}
+
 struct compression Compreeso_Cache = {
     .next = NULL,
     .name = "compresso_cache",
@@ -0,0 +1,266 @@
+/*
+
+    Hardware cost model layout
+
+    Turns compressed sizes into average access latency and DRAM traffic of a cacheline access,
+    with a latency table of decompressors and DRAM burst size set by -c options:
+
+        costmodel.latency=name:fixed:per_byte:unit[,...]   decompressor of name takes fixed cycles
+                                                           plus per_byte cycles for each compressed byte read.
+                                                           unit is the bytes decompressed together, 64 to PAGE_SIZE
+        costmodel.burst=bytes                              DRAM burst size, default 32
+        costmodel.dram=cycles                              DRAM access latency before first burst, default 100
+        costmodel.burst_cycles=cycles                      cycles per burst, default 4
+
+    Every cacheline of every non-zero page is accessed once.
+    Compressions with cacheline reports are modelled by line: a line takes its compressed size in bursts,
+    zero lines are known from metadata and take no DRAM access, lines not smaller than raw are not decompressed.
+    Other compressions are modelled by page in the final report: the line is in a unit of average compressed size,
+    which is read and decompressed from its start to the line.
+    Metadata is assumed to be cached.
+
+    HEAP Lab, Virginia Tech
+    Oct 2019
+
+*/
+
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+#include <plugin_struct.h>
+
+#define COSTMODEL_MAX (32)
+#define LINES (PAGE_SIZE / 64)
+
+struct layout LAYOUT_NODE_NAME;
+
+struct costmodel_entry
+{
+    char name[64];
+    double fixed;           //cycles
+    double per_byte;        //cycles per compressed byte
+    int unit;               //bytes decompressed together
+    struct compression * c_p;
+};
+
+//sums of all modelled line accesses of one compression
+struct costmodel_sum
+{
+    uint64_t lines;
+    uint64_t bursts;
+    double cycles;
+};
+
+//rough figures from the papers of each design, override with costmodel.latency
+static const char * costmodel_default = "bdi:1:0:64,cpack:8:0:64,bpc:7:0:128,bpc_compresso:7:0:64,sc2:8:0:64,"
+    "lz4:16:0.25:4096,deflate:32:1:4096,huffman1:16:0.5:4096";
+
+static struct costmodel_entry costmodel_table[COSTMODEL_MAX];
+static int costmodel_count;
+static int costmodel_burst, costmodel_dram, costmodel_burst_cycles;
+static struct costmodel_sum costmodel_line[COSTMODEL_MAX];     //by line, from cacheline reports
+static struct costmodel_sum costmodel_page[COSTMODEL_MAX];     //by page, from page_report
+static pthread_mutex_t costmodel_lock;
+__thread struct costmodel_sum costmodel_thread[COSTMODEL_MAX];
+
+static int costmodel_config(char * key, int value)
+{
+    char * v = shared_config(LAYOUT_NODE_NAME.sharedv, key);
+    return v != NULL ? strtol(v, NULL, 0) : value;
+}
+
+//adds entries of list to table, entries of the same name are replaced
+static void costmodel_parse(const char * list)
+{
+    char * copy = strdup(list), * save, * tok;
+    for (tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+    {
+        struct costmodel_entry e = {.unit = 64};
+        char * field = strchr(tok, ':');
+        if (field == NULL)
+            continue;
+        *field = '\0';
+        strncpy(e.name, tok, sizeof(e.name) - 1);
+        sscanf(field + 1, "%lf:%lf:%d", &e.fixed, &e.per_byte, &e.unit);
+        if (e.unit < 64 || e.unit > PAGE_SIZE || PAGE_SIZE % e.unit)
+            e.unit = 64;
+        int i;
+        for (i = 0; i < costmodel_count && strcmp(costmodel_table[i].name, e.name); i++);
+        if (i < COSTMODEL_MAX)
+        {
+            costmodel_table[i] = e;
+            costmodel_count += i == costmodel_count;
+        }
+    }
+    free(copy);
+}
+
+static int costmodel_bursts(double bytes)
+{
+    return (int)ceil(bytes / costmodel_burst);
+}
+
+//runs after compressions and layouts of higher priority have joined the list
+static void costmodel_init(struct compression ** c_p)
+{
+    int i, j;
+    costmodel_count = 0;
+    costmodel_burst = costmodel_config("costmodel.burst", 32);
+    costmodel_dram = costmodel_config("costmodel.dram", 100);
+    costmodel_burst_cycles = costmodel_config("costmodel.burst_cycles", 4);
+    if (costmodel_burst <= 0)
+        costmodel_burst = 32;
+    costmodel_parse(costmodel_default);
+    char * list = shared_config(LAYOUT_NODE_NAME.sharedv, "costmodel.latency");
+    if (list != NULL)
+        costmodel_parse(list);
+    //keep entries of compressions in list
+    struct compression * p;
+    for (i = j = 0; i < costmodel_count; i++)
+    {
+        for (p = *c_p; p != NULL && strcmp(p->name, costmodel_table[i].name); p = p->next);
+        if (p == NULL)
+            continue;
+        costmodel_table[j] = costmodel_table[i];
+        costmodel_table[j++].c_p = p;
+    }
+    costmodel_count = j;
+    memset(costmodel_line, 0, sizeof(costmodel_line));
+    memset(costmodel_page, 0, sizeof(costmodel_page));
+    costmodel_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+}
+
+//models lines of compressions with cacheline reports, in units of 64 bytes only
+static void costmodel_pr(struct compression * c_p, uint16_t * cl_list, uint16_t page_size, struct page_features * f)
+{
+    int i, j;
+    if (cl_list == NULL || CACHELINE_SIZE != 64)
+        return;
+    for (i = 0; i < costmodel_count && costmodel_table[i].c_p != c_p; i++);
+    if (i == costmodel_count || costmodel_table[i].unit != 64)
+        return;
+    struct costmodel_entry * e = &costmodel_table[i];
+    struct costmodel_sum * s = &costmodel_thread[i];
+    for (j = 0; j < LINES; j++)
+    {
+        s->lines++;
+        if (IS_ZERO_CACHELINE(cl_list[j]))
+            s->cycles += e->fixed;
+        else if (cl_list[j] >= 64 * 8)
+        {
+            s->bursts += costmodel_bursts(64);
+            s->cycles += costmodel_dram + costmodel_bursts(64) * costmodel_burst_cycles;
+        }
+        else
+        {
+            int bytes = (cl_list[j] + 7) / 8;
+            s->bursts += costmodel_bursts(bytes);
+            s->cycles += costmodel_dram + costmodel_bursts(bytes) * costmodel_burst_cycles + e->fixed + e->per_byte * bytes;
+        }
+    }
+}
+
+//models pages begin to end of compressions without cacheline reports, into sums of chunk
+static void costmodel_pages(void * arg, uint64_t begin, uint64_t end, int chunk)
+{
+    struct costmodel_sum * sum = (struct costmodel_sum *)arg + chunk * COSTMODEL_MAX;
+    int i, k;
+    uint64_t page;
+    for (i = 0; i < costmodel_count; i++)
+    {
+        struct costmodel_entry * e = &costmodel_table[i];
+        struct costmodel_sum * s = &sum[i];
+        int n = e->unit / 64;   //lines in unit
+        if (costmodel_line[i].lines)
+            continue;
+        for (page = begin; page < end; page++)
+        {
+            uint16_t size = e->c_p->page_report[page];
+            if (size == ZERO_SIZE)  //not measured
+                continue;
+            s->lines += LINES;
+            if (size >= PAGE_SIZE * 8)
+            {
+                s->bursts += LINES * costmodel_bursts(64);
+                s->cycles += LINES * (costmodel_dram + costmodel_bursts(64) * costmodel_burst_cycles);
+                continue;
+            }
+            //line k of the unit reads k + 1 of n parts of the compressed unit
+            double unit_bytes = size / 8.0 * e->unit / PAGE_SIZE;
+            for (k = 0; k < n; k++)
+            {
+                double bytes = unit_bytes * (k + 1) / n;
+                int bursts = costmodel_bursts(bytes);
+                s->bursts += (uint64_t)bursts * (LINES / n);
+                s->cycles += (costmodel_dram + bursts * costmodel_burst_cycles + e->fixed + e->per_byte * bytes) * (LINES / n);
+            }
+        }
+    }
+}
+
+//page reports are split into one chunk per thread
+static void costmodel_fr(struct compression * c_p, uint64_t totalpages)
+{
+    int t, i, threads = LAYOUT_NODE_NAME.sharedv->threads;
+    if (costmodel_count == 0)
+        return;
+    struct costmodel_sum * sum = calloc(threads * COSTMODEL_MAX, sizeof(struct costmodel_sum));
+    LAYOUT_NODE_NAME.sharedv->parallel_for(totalpages, costmodel_pages, sum);
+    for (t = 0; t < threads; t++)
+        for (i = 0; i < costmodel_count; i++)
+        {
+            costmodel_page[i].lines += sum[t * COSTMODEL_MAX + i].lines;
+            costmodel_page[i].bursts += sum[t * COSTMODEL_MAX + i].bursts;
+            costmodel_page[i].cycles += sum[t * COSTMODEL_MAX + i].cycles;
+        }
+    free(sum);
+}
+
+static void costmodel_tcr()
+{
+    int i;
+    pthread_mutex_lock(&costmodel_lock);
+    for (i = 0; i < costmodel_count; i++)
+    {
+        costmodel_line[i].lines += costmodel_thread[i].lines;
+        costmodel_line[i].bursts += costmodel_thread[i].bursts;
+        costmodel_line[i].cycles += costmodel_thread[i].cycles;
+    }
+    pthread_mutex_unlock(&costmodel_lock);
+    memset(costmodel_thread, 0, sizeof(costmodel_thread));
+}
+
+//average cycles per access:bandwidth saved, against uncompressed lines
+static void costmodel_cr()
+{
+    int i;
+    if (costmodel_count == 0)
+        return;
+    double raw_cycles = costmodel_dram + costmodel_bursts(64) * costmodel_burst_cycles;
+    printf("costmodel(cycles per access:bandwidth saved):burst=%d:uncompressed=%lf:", costmodel_burst, raw_cycles);
+    for (i = 0; i < costmodel_count; i++)
+    {
+        struct costmodel_sum * s = costmodel_line[i].lines ? &costmodel_line[i] : &costmodel_page[i];
+        if (s->lines == 0)
+            continue;
+        printf("%s=%lf:%lf:", costmodel_table[i].name, s->cycles / s->lines,
+            1 - s->bursts / (double)(s->lines * costmodel_bursts(64)));
+    }
+    printf("\n");
+    pthread_mutex_destroy(&costmodel_lock);
+}
+
+struct layout LAYOUT_NODE_NAME = {
+    .next = NULL,
+    .name = "costmodel",
+    .L_init = (layout_init_t) costmodel_init,
+    .L_page_r = (layout_page_report_t) costmodel_pr,
+    .L_final_r = (layout_final_report_t) costmodel_fr,
+    .L_thread_clean_r = (layout_thread_clean_t) costmodel_tcr,
+    .L_clean_r = (layout_clean_t) costmodel_cr,
+    .reports = NULL,
+    .report_count = 0,
+    .priority = -20,
+    .final_independent = 1
+};
@@ -0,0 +1,208 @@
+/*
+
+    Deduplication layout
+
+    Pages with the same content are stored once, as KSM does for identical pages.
+    Each page is hashed with a 128-bit hash by the worker that compressed it and inserted
+    into a lock-free hash set sized from the page count of the dump.
+    Compressed size with and without duplicates is reported for every compression in the end.
+    The set keeps the lowest page index of each content, and the page at that index is
+    the unique copy, so sizes without duplicates do not depend on thread timing.
+    The unique report is given by the first page of a content to reach the set, only its total is fixed.
+
+    HEAP Lab, Virginia Tech
+    Oct 2019
+
+*/
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <pagehash.h>
+#include <plugin_struct.h>
+
+#define DEDUP_NONE (UINT64_MAX)
+
+struct layout LAYOUT_NODE_NAME;
+struct compression COMPRESSION_NODE_NAME;
+
+static struct pagehash * dedup_set;     //open addressing, lo of 0 is empty slot
+static uint64_t * dedup_first;          //lowest page index of content in slot of dedup_set
+static uint64_t dedup_mask;
+static uint64_t * dedup_slot;           //slot of page content by page index, DEDUP_NONE if not hashed (zero page)
+static uint64_t dedup_unique, dedup_dups;
+static pthread_mutex_t dedup_lock;
+__thread uint64_t dedup_thread_unique, dedup_thread_dups;
+
+//sizes in bits by compression, computed in final report
+static int dedup_count;
+static char ** dedup_names;
+static uint64_t * dedup_size, * dedup_size_unique;
+
+static void dedup_init(struct compression ** c_p)
+{
+    LAYOUT_NODE_NAME.report_count = 0;
+    if (*c_p == NULL)
+        return;
+    struct compression * p;
+    for (p = *c_p; p->next != NULL; p = p->next);
+    p->next = &COMPRESSION_NODE_NAME;
+    LAYOUT_NODE_NAME.report_count = 1;
+    //at most 3/4 full when every page is unique
+    uint64_t pages = LAYOUT_NODE_NAME.sharedv->totalpages;
+    uint64_t slots = 1;
+    while (slots < pages + pages / 3 + 1)
+        slots <<= 1;
+    dedup_mask = slots - 1;
+    dedup_set = calloc(slots, sizeof(struct pagehash));
+    dedup_first = malloc(slots * sizeof(uint64_t));
+    memset(dedup_first, 0xff, slots * sizeof(uint64_t));
+    dedup_slot = malloc((pages + 1) * sizeof(uint64_t));
+    memset(dedup_slot, 0xff, (pages + 1) * sizeof(uint64_t));
+    dedup_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+    dedup_unique = dedup_dups = 0;
+}
+
+//returns 1 if content is already in set. Slot of content is written to slot
+static int dedup_insert(struct pagehash h, uint64_t * slot)
+{
+    uint64_t i;
+    for (i = h.lo & dedup_mask; ; i = (i + 1) & dedup_mask)
+    {
+        uint64_t lo = __atomic_load_n(&dedup_set[i].lo, __ATOMIC_ACQUIRE);
+        if (lo == 0)
+        {
+            if (__atomic_compare_exchange_n(&dedup_set[i].lo, &lo, h.lo, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+                __atomic_store_n(&dedup_set[i].hi, h.hi, __ATOMIC_RELEASE);
+                *slot = i;
+                return 0;
+            }
+            //lost the slot, lo is the winner's
+        }
+        if (lo == h.lo)
+        {
+            uint64_t hi;
+            while ((hi = __atomic_load_n(&dedup_set[i].hi, __ATOMIC_ACQUIRE)) == 0);   //winner is still writing
+            if (hi == h.hi)
+            {
+                *slot = i;
+                return 1;
+            }
+        }
+    }
+}
+
+static void dedup_pr(struct compression * c_p, uint16_t * cl_list, uint16_t page_size, struct page_features * f)
+{   return;}
+
+//runs after all compressions of the page. Reports page size for unique pages and 0 for duplicates
+static uint64_t dedup_cp(struct compression * c_p, uint8_t * start, uint16_t ** report, struct page_features * f)
+{
+    uint64_t slot, first;
+    int dup = dedup_insert(pagehash_compute(start, PAGE_SIZE), &slot);
+    dedup_slot[f->index] = slot;
+    first = __atomic_load_n(&dedup_first[slot], __ATOMIC_RELAXED);
+    while (f->index < first && !__atomic_compare_exchange_n(&dedup_first[slot], &first, f->index, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    if (dup)
+    {
+        dedup_thread_dups++;
+        return 0;
+    }
+    dedup_thread_unique++;
+    return PAGE_SIZE * 8;
+}
+
+//sums sizes of duplicate pages begin to end of every compression, into sums of chunk
+static void dedup_pages(void * arg, uint64_t begin, uint64_t end, int chunk)
+{
+    struct compression ** nodes = arg;
+    uint64_t * dup = dedup_size_unique + (chunk + 1) * dedup_count;
+    uint64_t i;
+    int j;
+    for (i = begin; i < end; i++)
+        if (dedup_slot[i] != DEDUP_NONE && dedup_first[dedup_slot[i]] != i)
+            for (j = 0; j < dedup_count; j++)
+                dup[j] += nodes[j]->page_report[i];
+}
+
+//takes out duplicate pages from size of every compression and other layouts
+static void dedup_fr(struct compression * c_p, uint64_t totalpages)
+{
+    if (!LAYOUT_NODE_NAME.report_count)
+        return;
+    struct compression * p;
+    int j, t, threads = LAYOUT_NODE_NAME.sharedv->threads;
+    dedup_count = 0;
+    for (p = c_p; p != NULL; p = p->next)
+        dedup_count += p != &COMPRESSION_NODE_NAME;
+    struct compression ** nodes = malloc(sizeof(struct compression *) * dedup_count);
+    dedup_names = malloc(sizeof(char *) * dedup_count);
+    dedup_size = malloc(sizeof(uint64_t) * dedup_count);
+    //sizes without duplicates, then sums of duplicates of each chunk
+    dedup_size_unique = calloc((threads + 1) * dedup_count, sizeof(uint64_t));
+    for (p = c_p, j = 0; p != NULL; p = p->next)
+        if (p != &COMPRESSION_NODE_NAME)
+            nodes[j++] = p;
+    LAYOUT_NODE_NAME.sharedv->parallel_for(totalpages, dedup_pages, nodes);
+    for (j = 0; j < dedup_count; j++)
+    {
+        dedup_names[j] = nodes[j]->name;
+        dedup_size[j] = nodes[j]->size;
+        dedup_size_unique[j] = nodes[j]->size;
+        for (t = 1; t <= threads; t++)
+            dedup_size_unique[j] -= dedup_size_unique[t * dedup_count + j];
+    }
+    free(nodes);
+}
+
+static void dedup_tcr()
+{
+    pthread_mutex_lock(&dedup_lock);
+    dedup_unique += dedup_thread_unique;
+    dedup_dups += dedup_thread_dups;
+    pthread_mutex_unlock(&dedup_lock);
+    dedup_thread_unique = dedup_thread_dups = 0;
+}
+
+//size in bits with duplicates:without duplicates
+static void dedup_cr()
+{
+    if (!LAYOUT_NODE_NAME.report_count)
+        return;
+    int j;
+    printf("dedup:unique pages=%"PRIu64":duplicate pages=%"PRIu64":%lf bytes per unique page\n", dedup_unique, dedup_dups,
+        dedup_unique ? ((dedup_mask + 1) * (sizeof(struct pagehash) + 8) + (LAYOUT_NODE_NAME.sharedv->totalpages + 1) * 8) / (double)dedup_unique : 0);
+    printf("dedup size(with:without duplicates):");
+    for (j = 0; j < dedup_count; j++)
+        printf("%s=%"PRIu64":%"PRIu64":", dedup_names[j], dedup_size[j], dedup_size_unique[j]);
+    printf("\n");
+    pthread_mutex_destroy(&dedup_lock);
+    free(dedup_set);
+    free(dedup_first);
+    free(dedup_slot);
+    free(dedup_names);
+    free(dedup_size);
+    free(dedup_size_unique);
+}
+
+struct compression COMPRESSION_NODE_NAME = {
+    .next = NULL,
+    .name = "unique",
+    .compress = (run_compression_t)dedup_cp,
+    .not_size = 1
+};
+
+struct layout LAYOUT_NODE_NAME = {
+    .next = NULL,
+    .name = "dedup",
+    .L_init = (layout_init_t) dedup_init,
+    .L_page_r = (layout_page_report_t) dedup_pr,
+    .L_final_r = (layout_final_report_t) dedup_fr,
+    .L_thread_clean_r = (layout_thread_clean_t) dedup_tcr,
+    .L_clean_r = (layout_clean_t) dedup_cr,
+    .reports = &COMPRESSION_NODE_NAME,
+    .report_count = 1,
+    .priority = -3,
+    .final_independent = 1
+};
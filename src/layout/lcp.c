@@ -0,0 +1,197 @@
+/*
+
+    Linearly Compressed Pages (LCP) layout
+
+    LCP compresses every cacheline of a page to one slot size, so the address of a line is its index times the slot.
+    Lines larger than the slot are exceptions, stored uncompressed in an exception region after the slots,
+    and the page keeps metadata with the exception index of each line.
+    See [Pekhimenko et al., MICRO 2013]
+    For each by-cacheline compression the slot of each page is the one giving the smallest physical page,
+    then fewest exceptions. Zero lines are marked in metadata and fit any slot.
+    Options by -c:
+        lcp.list=name,...       compressions, default bdi,cpack,bpc_compresso
+        lcp.slots=bytes,...     slot sizes to choose from, default 0,8,16,24,32,40,48,56
+        lcp.sizes=bytes,...     physical page sizes, default 512,1024,2048. Pages larger are uncompressed
+        lcp.metadata=bytes      metadata of a compressed page, default 64
+
+    HEAP Lab, Virginia Tech
+    Oct 2019
+
+*/
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <plugin_struct.h>
+
+#define LCP_MAX (8)         //compressions
+#define LCP_LIST (16)       //slots and physical sizes
+#define LINES (PAGE_SIZE / CACHELINE_SIZE)
+
+struct layout LAYOUT_NODE_NAME;
+
+struct lcp_sum
+{
+    uint64_t pages;
+    uint64_t bytes;         //physical
+    uint64_t exceptions;
+    uint64_t uncompressed;  //pages
+    uint64_t slot;          //sum of slots of compressed pages
+};
+
+static struct compression * lcp_c[LCP_MAX];
+static int lcp_n;
+static int lcp_slots[LCP_LIST], lcp_sizes[LCP_LIST];
+static int lcp_slot_count, lcp_size_count, lcp_metadata;
+static struct lcp_sum lcp_total[LCP_MAX];
+static pthread_mutex_t lcp_lock;
+__thread struct lcp_sum lcp_thread[LCP_MAX];
+
+//reads comma separated list of numbers, sorted
+static int lcp_list(char * key, char * value, int * list)
+{
+    char * v = shared_config(LAYOUT_NODE_NAME.sharedv, key);
+    char * copy = strdup(v != NULL ? v : value), * tok, * save;
+    int count = 0, i;
+    for (tok = strtok_r(copy, ",", &save); tok != NULL && count < LCP_LIST; tok = strtok_r(NULL, ",", &save))
+    {
+        int x = strtol(tok, NULL, 0);
+        for (i = count++; i > 0 && list[i - 1] > x; i--)
+            list[i] = list[i - 1];
+        list[i] = x;
+    }
+    free(copy);
+    return count;
+}
+
+//runs after compressions joined the list
+static void lcp_init(struct compression ** c_p)
+{
+    struct compression * p;
+    char * v, * list = shared_config(LAYOUT_NODE_NAME.sharedv, "lcp.list");
+    list = list != NULL ? list : "bdi,cpack,bpc_compresso";
+    lcp_n = 0;
+    for (p = *c_p; p != NULL && lcp_n < LCP_MAX; p = p->next)
+    {
+        char * s = strstr(list, p->name);
+        size_t len = strlen(p->name);
+        //whole names only
+        while (s != NULL && ((s != list && s[-1] != ',') || (s[len] != ',' && s[len] != '\0')))
+            s = strstr(s + 1, p->name);
+        if (s != NULL)
+            lcp_c[lcp_n++] = p;
+    }
+    lcp_slot_count = lcp_list("lcp.slots", "0,8,16,24,32,40,48,56", lcp_slots);
+    lcp_size_count = lcp_list("lcp.sizes", "512,1024,2048", lcp_sizes);
+    lcp_metadata = (v = shared_config(LAYOUT_NODE_NAME.sharedv, "lcp.metadata")) != NULL ? strtol(v, NULL, 0) : 64;
+    memset(lcp_total, 0, sizeof(lcp_total));
+    lcp_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+}
+
+//physical size of a page taking bytes, PAGE_SIZE if it does not fit
+static int lcp_physical(int bytes)
+{
+    int i;
+    for (i = 0; i < lcp_size_count; i++)
+        if (bytes <= lcp_sizes[i] && lcp_sizes[i] < PAGE_SIZE)
+            return lcp_sizes[i];
+    return PAGE_SIZE;
+}
+
+/*
+    Lines of a page are counted by size in bytes, so lines within a slot are a prefix sum
+    and each slot is evaluated once.
+*/
+static void lcp_pr(struct compression * c_p, uint16_t * cl_list, uint16_t page_size, struct page_features * f)
+{
+    int i, j;
+    if (cl_list == NULL)
+        return;
+    for (j = 0; j < lcp_n && lcp_c[j] != c_p; j++);
+    if (j == lcp_n)
+        return;
+    uint8_t count[CACHELINE_SIZE + 1] = {0};
+    for (i = 0; i < LINES; i++)
+    {
+        int bytes = IS_ZERO_CACHELINE(cl_list[i]) ? 0 : (cl_list[i] + 7) / 8;
+        count[bytes > CACHELINE_SIZE ? CACHELINE_SIZE : bytes]++;
+    }
+    int best = PAGE_SIZE, best_exceptions = LINES, best_slot = CACHELINE_SIZE, fit = 0, b = 0;
+    for (i = 0; i < lcp_slot_count; i++)
+    {
+        int slot = lcp_slots[i] > CACHELINE_SIZE ? CACHELINE_SIZE : lcp_slots[i];
+        for (; b <= slot; b++)
+            fit += count[b];
+        int exceptions = LINES - fit;
+        int size = lcp_physical(slot * LINES + exceptions * CACHELINE_SIZE + lcp_metadata);
+        if (size < best || (size == best && exceptions < best_exceptions))
+        {
+            best = size;
+            best_exceptions = exceptions;
+            best_slot = slot;
+        }
+    }
+    struct lcp_sum * s = &lcp_thread[j];
+    s->pages++;
+    s->bytes += best;
+    if (best == PAGE_SIZE)
+        s->uncompressed++;
+    else
+    {
+        s->exceptions += best_exceptions;
+        s->slot += best_slot;
+    }
+}
+
+static void lcp_fr()
+{   return;}
+
+static void lcp_tcr()
+{
+    int i;
+    pthread_mutex_lock(&lcp_lock);
+    for (i = 0; i < lcp_n; i++)
+    {
+        lcp_total[i].pages += lcp_thread[i].pages;
+        lcp_total[i].bytes += lcp_thread[i].bytes;
+        lcp_total[i].exceptions += lcp_thread[i].exceptions;
+        lcp_total[i].uncompressed += lcp_thread[i].uncompressed;
+        lcp_total[i].slot += lcp_thread[i].slot;
+    }
+    pthread_mutex_unlock(&lcp_lock);
+    memset(lcp_thread, 0, sizeof(lcp_thread));
+}
+
+//exception rate is over lines of compressed pages
+static void lcp_cr()
+{
+    int i;
+    if (lcp_n == 0)
+        return;
+    printf("lcp(ratio:exception rate:uncompressed pages:average slot):");
+    for (i = 0; i < lcp_n; i++)
+    {
+        struct lcp_sum * s = &lcp_total[i];
+        uint64_t compressed = s->pages - s->uncompressed;
+        if (s->pages == 0)
+            continue;
+        printf("%s=%lf:%lf:%lf:%lf:", lcp_c[i]->name, s->pages * (double)PAGE_SIZE / s->bytes,
+            compressed ? s->exceptions / (double)(compressed * LINES) : 0, s->uncompressed / (double)s->pages,
+            compressed ? s->slot / (double)compressed : 0);
+    }
+    printf("\n");
+    pthread_mutex_destroy(&lcp_lock);
+}
+
+struct layout LAYOUT_NODE_NAME = {
+    .next = NULL,
+    .name = "lcp",
+    .L_init = (layout_init_t) lcp_init,
+    .L_page_r = (layout_page_report_t) lcp_pr,
+    .L_final_r = (layout_final_report_t) lcp_fr,
+    .L_thread_clean_r = (layout_thread_clean_t) lcp_tcr,
+    .L_clean_r = (layout_clean_t) lcp_cr,
+    .reports = NULL,
+    .report_count = 0,
+    .priority = -20
+};
@@ -0,0 +1,177 @@
+/*
+
+    Compresso metadata cache simulation
+
+    Compresso keeps 64 bytes of metadata per page, and every access to a compressed page needs it.
+    A memory access trace is replayed through a set-associative LRU cache of page metadata, set by -c options:
+
+        mdcache.trace=file      text lines of "address R|W", address in hex. Required
+        mdcache.size=bytes      cache capacity, default 65536
+        mdcache.ways=ways       associativity, default 8
+        mdcache.source=name     compression or layout report giving compressed page size, default compresso_cache
+
+    Addresses are virtual addresses mapped to pages by the loaded segments of an ELF dump,
+    or offsets into the dump if it is parsed memory. Accesses outside the dump are counted and passed over.
+    A miss reads the metadata from DRAM, and writes make it dirty so its eviction writes it back.
+    Data traffic of an access is the average compressed line of its page in source, zero pages take none.
+    The trace is read as a stream, it is never held in memory.
+
+    HEAP Lab, Virginia Tech
+    Oct 2019
+
+*/
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <plugin_struct.h>
+#include <dump.h>
+
+#define MDCACHE_ENTRY (64)      //metadata of a page in bytes
+#define LINES (PAGE_SIZE / CACHELINE_SIZE)
+
+struct layout LAYOUT_NODE_NAME;
+
+static char * mdcache_fn;
+static char * mdcache_source_name;
+static struct compression * mdcache_source;
+static uint64_t mdcache_sets;
+static int mdcache_ways;
+
+//tags are page index + 1, 0 is empty
+static uint64_t * mdcache_tag;
+static uint64_t * mdcache_used;         //time of last access, for LRU
+static uint8_t * mdcache_dirty;
+
+enum {MD_ACCESS, MD_WRITE, MD_HIT, MD_MISS, MD_WRITEBACK, MD_UNMAPPED, MD_DATA, MD_COUNT};
+static uint64_t mdcache_count[MD_COUNT];
+
+static void mdcache_init(struct compression ** c_p)
+{
+    struct shared * sh = LAYOUT_NODE_NAME.sharedv;
+    char * v;
+    mdcache_fn = shared_config(sh, "mdcache.trace");
+    mdcache_source_name = shared_config(sh, "mdcache.source");
+    if (mdcache_source_name == NULL)
+        mdcache_source_name = "compresso_cache";
+    mdcache_ways = (v = shared_config(sh, "mdcache.ways")) != NULL ? strtol(v, NULL, 0) : 8;
+    uint64_t size = (v = shared_config(sh, "mdcache.size")) != NULL ? strtoull(v, NULL, 0) : 65536;
+    if (mdcache_ways <= 0)
+        mdcache_ways = 8;
+    mdcache_sets = size / MDCACHE_ENTRY / mdcache_ways;
+    if (mdcache_sets == 0)
+        mdcache_sets = 1;
+    memset(mdcache_count, 0, sizeof(mdcache_count));
+}
+
+static void mdcache_pr(struct compression * c_p, uint16_t * cl_list, uint16_t page_size, struct page_features * f)
+{   return;}
+
+static void mdcache_access(uint64_t page, int write)
+{
+    uint64_t set = page % mdcache_sets, now = mdcache_count[MD_ACCESS];
+    uint64_t * tag = mdcache_tag + set * mdcache_ways;
+    uint64_t * used = mdcache_used + set * mdcache_ways;
+    uint8_t * dirty = mdcache_dirty + set * mdcache_ways;
+    int w, victim = 0;
+    mdcache_count[MD_ACCESS]++;
+    mdcache_count[MD_WRITE] += write;
+    for (w = 0; w < mdcache_ways; w++)
+    {
+        if (tag[w] == page + 1)
+        {
+            mdcache_count[MD_HIT]++;
+            used[w] = now;
+            dirty[w] |= write;
+            return;
+        }
+        //empty way first, then least recently used
+        if (tag[victim] != 0 && (tag[w] == 0 || used[w] < used[victim]))
+            victim = w;
+    }
+    mdcache_count[MD_MISS]++;
+    mdcache_count[MD_WRITEBACK] += dirty[victim];
+    tag[victim] = page + 1;
+    used[victim] = now;
+    dirty[victim] = write;
+}
+
+//replays trace, needs page reports of source
+static void mdcache_fr(struct compression * c_p, uint64_t totalpages)
+{
+    if (mdcache_fn == NULL)
+        return;
+    for (mdcache_source = c_p; mdcache_source != NULL && strcmp(mdcache_source->name, mdcache_source_name);
+        mdcache_source = mdcache_source->next);
+    FILE * tf = fopen(mdcache_fn, "r");
+    if (tf == NULL || mdcache_source == NULL)
+    {
+        printf("mdcache: cannot open %s or find %s\n", mdcache_fn, mdcache_source_name);
+        if (tf != NULL)
+            fclose(tf);
+        mdcache_fn = NULL;
+        return;
+    }
+    struct dump_segment * seg;
+    int segs = dump_segments(LAYOUT_NODE_NAME.sharedv->filename, &seg);
+    mdcache_tag = calloc(mdcache_sets * mdcache_ways, sizeof(uint64_t));
+    mdcache_used = calloc(mdcache_sets * mdcache_ways, sizeof(uint64_t));
+    mdcache_dirty = calloc(mdcache_sets * mdcache_ways, sizeof(uint8_t));
+    char line[256];
+    while (fgets(line, sizeof(line), tf) != NULL)
+    {
+        char * op;
+        uint64_t address = strtoull(line, &op, 16);
+        if (op == line)
+            continue;
+        while (*op == ' ' || *op == '\t' || *op == ',')
+            op++;
+        int64_t page = segs ? dump_page(seg, segs, address) : (int64_t)(address / PAGE_SIZE);
+        if (page < 0 || page >= totalpages)
+        {
+            mdcache_count[MD_UNMAPPED]++;
+            continue;
+        }
+        mdcache_access(page, *op == 'W' || *op == 'w');
+        uint16_t size = mdcache_source->page_report[page];
+        if (size != ZERO_SIZE)
+            mdcache_count[MD_DATA] += (size / 8 + LINES - 1) / LINES;
+    }
+    fclose(tf);
+    free(seg);
+    free(mdcache_tag);
+    free(mdcache_used);
+    free(mdcache_dirty);
+}
+
+static void mdcache_tcr()
+{   return;}
+
+//bandwidth is data and metadata traffic against uncompressed accesses
+static void mdcache_cr()
+{
+    if (mdcache_fn == NULL)
+        return;
+    uint64_t * n = mdcache_count;
+    uint64_t extra = n[MD_MISS] + n[MD_WRITEBACK];
+    printf("mdcache:accesses=%"PRIu64":writes=%"PRIu64":unmapped=%"PRIu64":hit rate=%lf:extra DRAM accesses=%"PRIu64"(%lf per access)",
+        n[MD_ACCESS], n[MD_WRITE], n[MD_UNMAPPED], n[MD_ACCESS] ? n[MD_HIT] / (double)n[MD_ACCESS] : 0,
+        extra, n[MD_ACCESS] ? extra / (double)n[MD_ACCESS] : 0);
+    printf(":bandwidth change with %s=%lf:without metadata=%lf\n", mdcache_source_name,
+        n[MD_ACCESS] ? (n[MD_DATA] + extra * MDCACHE_ENTRY) / (double)(n[MD_ACCESS] * CACHELINE_SIZE) - 1 : 0,
+        n[MD_ACCESS] ? n[MD_DATA] / (double)(n[MD_ACCESS] * CACHELINE_SIZE) - 1 : 0);
+}
+
+struct layout LAYOUT_NODE_NAME = {
+    .next = NULL,
+    .name = "mdcache",
+    .L_init = (layout_init_t) mdcache_init,
+    .L_page_r = (layout_page_report_t) mdcache_pr,
+    .L_final_r = (layout_final_report_t) mdcache_fr,
+    .L_thread_clean_r = (layout_thread_clean_t) mdcache_tcr,
+    .L_clean_r = (layout_clean_t) mdcache_cr,
+    .reports = NULL,
+    .report_count = 0,
+    .priority = -20,
+    .final_independent = 1
+};
@@ -0,0 +1,282 @@
+/*
+
+    Optimal compression subset search
+
+    Finds which k compressions a design should implement, if each page is stored by the best compression of the subset.
+    Every subset of up to k compressions is evaluated from page reports in the final report, without compressing again.
+    A page takes the smallest size in the subset plus selector bits to tell which one was used.
+    Options by -c:
+        subset.k=k              largest subset, default 2
+        subset.list=name,...    compressions to choose from, default every compression
+        subset.top=count        subsets printed for each size, default 5
+        subset.selector=bits    selector bits per choice, default log2 of choices rounded up
+        subset.lines=1          also keep cacheline reports, so a page can take the best compression of each cacheline
+                                among by-cacheline compressions of the subset. Needs 128 bytes per page per compression
+
+    Pages are split into one chunk per thread by parallel_for of driver and evaluated in blocks.
+    Minimum of a subset in a block is the minimum of the subset without its lowest compression and that compression,
+    so each subset costs one pass of element-wise minimum over the block.
+
+    HEAP Lab, Virginia Tech
+    Oct 2019
+
+*/
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <plugin_struct.h>
+
+#define SUBSET_MAX (20)     //compressions to choose from
+#define BLOCK (256)         //pages in a block
+#define LINE_BLOCK (32)     //pages in a block with cacheline reports
+#define LINES (PAGE_SIZE / CACHELINE_SIZE)
+#define NONE (0xffff)
+
+struct layout LAYOUT_NODE_NAME;
+
+static struct compression * subset_c[SUBSET_MAX];
+static uint16_t * subset_lines[SUBSET_MAX];     //cacheline reports by page, NULL for page-level compressions
+static pthread_mutex_t subset_lock;
+static int subset_n, subset_k, subset_top, subset_selector, subset_use_lines;
+
+//subsets of up to k compressions by bit mask, ordered by size
+static uint32_t * subset_mask;
+static int subset_count;
+static int * subset_index;      //by mask, -1 if larger than k
+static uint64_t * subset_total; //bits of each subset
+static uint64_t subset_pages;
+
+static int subset_config(char * key, int value)
+{
+    char * v = shared_config(LAYOUT_NODE_NAME.sharedv, key);
+    return v != NULL ? strtol(v, NULL, 0) : value;
+}
+
+//runs before layouts add their reports, so only compressions are in list
+static void subset_init(struct compression ** c_p)
+{
+    struct compression * p;
+    char * list = shared_config(LAYOUT_NODE_NAME.sharedv, "subset.list");
+    subset_k = subset_config("subset.k", 2);
+    subset_top = subset_config("subset.top", 5);
+    subset_selector = subset_config("subset.selector", -1);
+    subset_use_lines = subset_config("subset.lines", 0);
+    subset_n = 0;
+    subset_count = 0;
+    for (p = *c_p; p != NULL && subset_n < SUBSET_MAX; p = p->next)
+    {
+        if (list != NULL)
+        {
+            char * s = strstr(list, p->name);
+            size_t len = strlen(p->name);
+            //whole names only
+            while (s != NULL && ((s != list && s[-1] != ',') || (s[len] != ',' && s[len] != '\0')))
+                s = strstr(s + 1, p->name);
+            if (s == NULL)
+                continue;
+        }
+        subset_lines[subset_n] = NULL;
+        subset_c[subset_n++] = p;
+    }
+    if (subset_k > subset_n)
+        subset_k = subset_n;
+    subset_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+}
+
+//keeps cacheline reports with subset.lines
+static void subset_pr(struct compression * c_p, uint16_t * cl_list, uint16_t page_size, struct page_features * f)
+{
+    int i;
+    if (!subset_use_lines || cl_list == NULL || subset_k == 0)
+        return;
+    for (i = 0; i < subset_n && subset_c[i] != c_p; i++);
+    if (i == subset_n)
+        return;
+    uint16_t * lines = __atomic_load_n(&subset_lines[i], __ATOMIC_ACQUIRE);
+    if (lines == NULL)
+    {
+        pthread_mutex_lock(&subset_lock);
+        if ((lines = subset_lines[i]) == NULL)
+        {
+            lines = malloc(sizeof(uint16_t) * LINES * LAYOUT_NODE_NAME.sharedv->totalpages);
+            memset(lines, 0xff, sizeof(uint16_t) * LINES * LAYOUT_NODE_NAME.sharedv->totalpages);
+            __atomic_store_n(&subset_lines[i], lines, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&subset_lock);
+    }
+    for (i = 0; i < LINES; i++)
+        lines[f->index * LINES + i] = NORM_CACHELINE(cl_list[i]);
+}
+
+static int subset_bits(int choices)
+{
+    if (choices <= 1)
+        return 0;
+    if (subset_selector >= 0)
+        return subset_selector;
+    return 32 - __builtin_clz(choices - 1);
+}
+
+static inline void subset_min(uint16_t * dest, uint16_t * a, uint16_t * b, int n)
+{
+    int i;
+    for (i = 0; i < n; i++)
+        dest[i] = a[i] < b[i] ? a[i] : b[i];
+}
+
+/*
+    Evaluates every subset over pages begin to end.
+    page[s] holds minimum page report of subset s for each page of a block,
+    line[s] the sum of minimum cacheline of by-cacheline compressions in subset s, or NONE.
+*/
+static void subset_pages_eval(void * arg, uint64_t begin, uint64_t end, int chunk)
+{
+    uint64_t * total = (uint64_t *)arg + chunk * (subset_count + 1);   //totals of subsets, then pages
+    int block = subset_use_lines ? LINE_BLOCK : BLOCK;
+    uint16_t * page = malloc(sizeof(uint16_t) * subset_count * block);
+    uint16_t * line = subset_use_lines ? malloc(sizeof(uint16_t) * subset_count * block * LINES) : NULL;
+    uint32_t * linesum = malloc(sizeof(uint32_t) * block);
+    uint8_t valid[BLOCK];
+    uint64_t b;
+    int s, i, j, n;
+    for (b = begin; b < end; b += block)
+    {
+        n = end - b < block ? end - b : block;
+        for (i = 0; i < n; i++)
+        {
+            valid[i] = subset_c[0]->page_report[b + i] != ZERO_SIZE;
+            total[subset_count] += valid[i];
+        }
+        for (s = 0; s < subset_count; s++)
+        {
+            uint32_t mask = subset_mask[s];
+            int low = __builtin_ctz(mask);
+            uint16_t * dest = page + s * block;
+            uint16_t * ldest = line != NULL ? line + s * block * LINES : NULL;
+            if ((mask & (mask - 1)) == 0)
+            {
+                memcpy(dest, subset_c[low]->page_report + b, sizeof(uint16_t) * n);
+                if (ldest != NULL && subset_lines[low] != NULL)
+                    memcpy(ldest, subset_lines[low] + b * LINES, sizeof(uint16_t) * n * LINES);
+                else if (ldest != NULL)
+                    memset(ldest, 0xff, sizeof(uint16_t) * n * LINES);
+            }
+            else
+            {
+                int rest = subset_index[mask & (mask - 1)], single = subset_index[1u << low];
+                subset_min(dest, page + rest * block, page + single * block, n);
+                if (ldest != NULL)
+                    subset_min(ldest, line + rest * block * LINES, line + single * block * LINES, n * LINES);
+            }
+            //selectors of each page, and of each cacheline if a page is stored by cacheline
+            int count = __builtin_popcount(mask), line_count = 0;
+            for (j = 0; j < subset_n; j++)
+                line_count += (mask >> j & 1) && subset_lines[j] != NULL;
+            for (i = 0; i < n; i++)
+                linesum[i] = UINT32_MAX;
+            if (ldest != NULL && line_count > 0)
+                for (i = 0; i < n; i++)
+                {
+                    linesum[i] = LINES * subset_bits(line_count);
+                    for (j = 0; j < LINES; j++)
+                        linesum[i] += ldest[i * LINES + j];
+                }
+            uint64_t sum = 0;
+            for (i = 0; i < n; i++)
+                if (valid[i])
+                    sum += (dest[i] < linesum[i] ? dest[i] : linesum[i]) + subset_bits(count + (line_count > 0 && ldest != NULL));
+            total[s] += sum;
+        }
+    }
+    free(page);
+    free(line);
+    free(linesum);
+}
+
+static void subset_fr(struct compression * c_p, uint64_t totalpages)
+{
+    int t, s, threads = LAYOUT_NODE_NAME.sharedv->threads;
+    uint32_t mask;
+    if (subset_k == 0 || totalpages == 0)
+        return;
+    //subsets by size, each after the subset without its lowest compression
+    subset_index = malloc(sizeof(int) << subset_n);
+    subset_mask = malloc(sizeof(uint32_t) << subset_n);
+    for (mask = 0; mask < (1u << subset_n); mask++)
+        subset_index[mask] = -1;
+    for (t = 1; t <= subset_k; t++)
+        for (mask = 1; mask < (1u << subset_n); mask++)
+            if (__builtin_popcount(mask) == t)
+            {
+                subset_index[mask] = subset_count;
+                subset_mask[subset_count++] = mask;
+            }
+    subset_total = calloc(subset_count, sizeof(uint64_t));
+    uint64_t * total = calloc(threads * (subset_count + 1), sizeof(uint64_t));
+    LAYOUT_NODE_NAME.sharedv->parallel_for(totalpages, subset_pages_eval, total);
+    subset_pages = 0;
+    for (t = 0; t < threads; t++)
+    {
+        for (s = 0; s < subset_count; s++)
+            subset_total[s] += total[t * (subset_count + 1) + s];
+        subset_pages += total[t * (subset_count + 1) + subset_count];
+    }
+    free(total);
+}
+
+static void subset_tcr()
+{   return;}
+
+static int subset_cmp(const void * a, const void * b)
+{
+    uint64_t x = subset_total[*(int *)a], y = subset_total[*(int *)b];
+    return x < y ? -1 : x > y;
+}
+
+//best subsets of each size by ratio, names joined by +
+static void subset_cr()
+{
+    int t, s, j;
+    if (subset_count == 0)
+        return;
+    int * order = malloc(sizeof(int) * subset_count);
+    for (t = 1; t <= subset_k; t++)
+    {
+        int count = 0;
+        for (s = 0; s < subset_count; s++)
+            if (__builtin_popcount(subset_mask[s]) == t)
+                order[count++] = s;
+        qsort(order, count, sizeof(int), subset_cmp);
+        printf("subset k=%d(ratio):", t);
+        for (s = 0; s < count && s < subset_top; s++)
+        {
+            for (j = 0; j < subset_n; j++)
+                if (subset_mask[order[s]] >> j & 1)
+                    printf("%s%s", subset_mask[order[s]] & ((1u << j) - 1) ? "+" : "", subset_c[j]->name);
+            printf("=%lf:", subset_total[order[s]] ? subset_pages * PAGE_SIZE * 8.0 / subset_total[order[s]] : 0);
+        }
+        printf("\n");
+    }
+    free(order);
+    for (j = 0; j < subset_n; j++)
+        free(subset_lines[j]);
+    free(subset_index);
+    free(subset_mask);
+    free(subset_total);
+    pthread_mutex_destroy(&subset_lock);
+}
+
+struct layout LAYOUT_NODE_NAME = {
+    .next = NULL,
+    .name = "subset",
+    .L_init = (layout_init_t) subset_init,
+    .L_page_r = (layout_page_report_t) subset_pr,
+    .L_final_r = (layout_final_report_t) subset_fr,
+    .L_thread_clean_r = (layout_thread_clean_t) subset_tcr,
+    .L_clean_r = (layout_clean_t) subset_cr,
+    .reports = NULL,
+    .report_count = 0,
+    .priority = 10,
+    .final_independent = 1
+};
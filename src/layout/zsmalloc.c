@@ -0,0 +1,207 @@
+/*
+
+    zsmalloc layout
+
+    zram and zswap keep compressed pages in zsmalloc, which packs objects into size classes.
+    A class holds objects of up to its size in zspages of 1 to chain pages, chosen so the zspage wastes the least.
+    Classes of the same zspage geometry are merged into the larger one, as the kernel does.
+    Pages compressed to the huge class size or more are stored uncompressed (incompressible),
+    same-filled pages take no object. Footprint assumes zspages are filled in order, without frees.
+    Options by -c:
+        zsmalloc.list=name,...      compressions, default every compression and layout report of a size
+        zsmalloc.chain=pages        most pages in a zspage, default 4 (8 on kernels with CONFIG_ZSMALLOC_CHAIN_SIZE)
+
+    HEAP Lab, Virginia Tech
+    Oct 2019
+
+*/
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <plugin_struct.h>
+
+#define ZS_MAX (32)                             //compressions
+#define ZS_MIN_ALLOC_SIZE (32)
+#define ZS_HANDLE_SIZE (8)                      //added to every object before class lookup
+#define ZS_CLASS_BITS (8)
+#define ZS_SIZE_CLASS_DELTA (PAGE_SIZE >> ZS_CLASS_BITS)
+#define ZS_SIZE_CLASSES ((PAGE_SIZE - ZS_MIN_ALLOC_SIZE + ZS_SIZE_CLASS_DELTA - 1) / ZS_SIZE_CLASS_DELTA + 1)
+
+struct layout LAYOUT_NODE_NAME;
+
+struct zs_class
+{
+    int size;
+    int pages;      //pages per zspage
+    int objs;       //objects per zspage
+    int merged;     //index of class objects are stored in
+};
+
+struct zs_sum
+{
+    uint64_t pages;
+    uint64_t bytes;         //compressed
+    uint64_t huge;          //incompressible pages
+    uint64_t same;          //same-filled pages
+    uint64_t objs[ZS_SIZE_CLASSES];
+};
+
+static struct compression * zs_c[ZS_MAX];
+static int zs_n;
+static struct zs_class zs_class[ZS_SIZE_CLASSES];
+static int zs_huge_size;
+static struct zs_sum zs_total[ZS_MAX];
+static pthread_mutex_t zs_lock;
+__thread struct zs_sum zs_thread[ZS_MAX];
+
+//pages per zspage using the most of its space, the first one if equal
+static int zs_pages_per_zspage(int size, int chain)
+{
+    int i, best = 1, best_used = 0;
+    for (i = 1; i <= chain; i++)
+    {
+        int zspage = i * PAGE_SIZE;
+        int used = (zspage - zspage % size) * 100 / zspage;
+        if (used > best_used)
+        {
+            best_used = used;
+            best = i;
+        }
+    }
+    return best;
+}
+
+//size class table, built from the largest class down as zs_create_pool does
+static void zs_classes(int chain)
+{
+    int i, prev = -1;
+    zs_huge_size = 0;
+    for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--)
+    {
+        struct zs_class * c = &zs_class[i];
+        c->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+        if (c->size > PAGE_SIZE)
+            c->size = PAGE_SIZE;
+        c->pages = zs_pages_per_zspage(c->size, chain);
+        c->objs = c->pages * PAGE_SIZE / c->size;
+        //objects from the largest class not alone in its page, less the handle, are huge
+        if (c->pages != 1 && c->objs != 1 && zs_huge_size == 0)
+            zs_huge_size = c->size - (ZS_HANDLE_SIZE - 1);
+        c->merged = i;
+        if (prev >= 0 && zs_class[prev].pages == c->pages && zs_class[prev].objs == c->objs)
+            c->merged = zs_class[prev].merged;
+        prev = i;
+    }
+}
+
+static void zs_init(struct compression ** c_p)
+{
+    struct compression * p;
+    char * v, * list = shared_config(LAYOUT_NODE_NAME.sharedv, "zsmalloc.list");
+    int chain = (v = shared_config(LAYOUT_NODE_NAME.sharedv, "zsmalloc.chain")) != NULL ? strtol(v, NULL, 0) : 4;
+    zs_classes(chain > 0 ? chain : 4);
+    zs_n = 0;
+    for (p = *c_p; p != NULL && zs_n < ZS_MAX; p = p->next)
+    {
+        if (list != NULL)
+        {
+            char * s = strstr(list, p->name);
+            size_t len = strlen(p->name);
+            //whole names only
+            while (s != NULL && ((s != list && s[-1] != ',') || (s[len] != ',' && s[len] != '\0')))
+                s = strstr(s + 1, p->name);
+            if (s == NULL)
+                continue;
+        }
+        else if (p->not_size)
+            continue;
+        zs_c[zs_n++] = p;
+    }
+    memset(zs_total, 0, sizeof(zs_total));
+    zs_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+}
+
+static void zs_pr(struct compression * c_p, uint16_t * cl_list, uint16_t page_size, struct page_features * f)
+{
+    int j;
+    for (j = 0; j < zs_n && zs_c[j] != c_p; j++);
+    if (j == zs_n)
+        return;
+    struct zs_sum * s = &zs_thread[j];
+    s->pages++;
+    if (f->same_filled)
+    {
+        s->same++;
+        return;
+    }
+    int bytes = (page_size + 7) / 8;
+    if (bytes >= zs_huge_size)
+    {
+        s->huge++;
+        bytes = PAGE_SIZE;
+    }
+    s->bytes += bytes;
+    bytes += ZS_HANDLE_SIZE;
+    int i = bytes <= ZS_MIN_ALLOC_SIZE ? 0 : (bytes - ZS_MIN_ALLOC_SIZE + ZS_SIZE_CLASS_DELTA - 1) / ZS_SIZE_CLASS_DELTA;
+    i = i < ZS_SIZE_CLASSES ? i : ZS_SIZE_CLASSES - 1;
+    s->objs[zs_class[i].merged]++;
+}
+
+static void zs_fr()
+{   return;}
+
+static void zs_tcr()
+{
+    int i, j;
+    pthread_mutex_lock(&zs_lock);
+    for (j = 0; j < zs_n; j++)
+    {
+        zs_total[j].pages += zs_thread[j].pages;
+        zs_total[j].bytes += zs_thread[j].bytes;
+        zs_total[j].huge += zs_thread[j].huge;
+        zs_total[j].same += zs_thread[j].same;
+        for (i = 0; i < ZS_SIZE_CLASSES; i++)
+            zs_total[j].objs[i] += zs_thread[j].objs[i];
+    }
+    pthread_mutex_unlock(&zs_lock);
+    memset(zs_thread, 0, sizeof(zs_thread));
+}
+
+//fragmentation is the share of footprint not holding compressed data
+static void zs_cr()
+{
+    int i, j, classes = 0;
+    if (zs_n == 0)
+        return;
+    for (i = 0; i < ZS_SIZE_CLASSES; i++)
+        classes += zs_class[i].merged == i;
+    printf("zsmalloc(ratio:footprint bytes:fragmentation:incompressible:same filled):classes=%d:huge class=%d:", classes, zs_huge_size);
+    for (j = 0; j < zs_n; j++)
+    {
+        struct zs_sum * s = &zs_total[j];
+        uint64_t footprint = 0;
+        if (s->pages == 0)
+            continue;
+        for (i = 0; i < ZS_SIZE_CLASSES; i++)
+            if (s->objs[i])
+                footprint += (s->objs[i] + zs_class[i].objs - 1) / zs_class[i].objs * zs_class[i].pages * PAGE_SIZE;
+        printf("%s=%lf:%"PRIu64":%lf:%lf:%lf:", zs_c[j]->name, footprint ? s->pages * (double)PAGE_SIZE / footprint : 0, footprint,
+            footprint ? 1 - s->bytes / (double)footprint : 0, s->huge / (double)s->pages, s->same / (double)s->pages);
+    }
+    printf("\n");
+    pthread_mutex_destroy(&zs_lock);
+}
+
+struct layout LAYOUT_NODE_NAME = {
+    .next = NULL,
+    .name = "zsmalloc",
+    .L_init = (layout_init_t) zs_init,
+    .L_page_r = (layout_page_report_t) zs_pr,
+    .L_final_r = (layout_final_report_t) zs_fr,
+    .L_thread_clean_r = (layout_thread_clean_t) zs_tcr,
+    .L_clean_r = (layout_clean_t) zs_cr,
+    .reports = NULL,
+    .report_count = 0,
+    .priority = -20
+};
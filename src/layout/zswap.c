@@ -0,0 +1,308 @@
+/*
+
+    zswap pool simulation
+
+    Pages of the dump are swapped into a zswap pool of limited size, and an access order is replayed over it.
+    An access to a page in the pool is a hit. Otherwise the page is read from swap, or touched the first time,
+    and is stored in the pool again as most recently used. When the pool would grow above its limit,
+    least recently used pages are written back to swap until the pool is below the accept threshold.
+    Same-filled pages (zero pages included) are kept as a value and take no pool space,
+    pages not smaller than PAGE_SIZE after compression are rejected and go to swap.
+    Pool space of a page is its compressed size in bytes, allocator overhead is not counted (see zsmalloc).
+    Options by -c:
+        zswap.trace=file                text lines of "address", address in hex. Default every page in dump order
+        zswap.list=name,...             compressions, default lz4,deflate
+        zswap.max_pool_percent=percent  pool limit, default 20
+        zswap.accept_threshold=percent  pool is shrunk to this percent of the limit, default 90
+        zswap.memory=bytes              memory the limit is a percent of, default size of the dump
+
+    Addresses are mapped to pages as mdcache does. The trace is read in blocks, each block is replayed
+    for every compression in parallel with sharedv->parallel_for. The LRU is a list linked by page index,
+    so an access is O(1).
+
+    HEAP Lab, Virginia Tech
+    Oct 2019
+
+*/
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <plugin_struct.h>
+#include <dump.h>
+
+#define ZSWAP_MAX (16)          //compressions
+#define ZSWAP_BLOCK (1 << 20)   //accesses read at once
+#define NONE (UINT32_MAX)
+
+struct layout LAYOUT_NODE_NAME;
+
+enum {ZS_ABSENT, ZS_POOL, ZS_SAME, ZS_SWAP};
+enum {ZW_ACCESS, ZW_HIT, ZW_COLD, ZW_SWAPIN, ZW_REJECT, ZW_WRITEBACK, ZW_COUNT};
+
+struct zswap_pool
+{
+    struct compression * c_p;
+    uint32_t * prev, * next;    //LRU list, by page index
+    uint8_t * state;
+    uint32_t head, tail;        //most and least recently used
+    uint64_t bytes;
+    uint64_t count[ZW_COUNT];
+    int64_t * block;            //accesses to replay
+    int block_count;
+};
+
+static struct zswap_pool zswap_pool[ZSWAP_MAX];
+static int zswap_n;
+static char * zswap_fn;
+static uint64_t zswap_limit, zswap_accept, zswap_pages;
+static uint8_t * zswap_same;    //bitmap of same-filled pages, set in page loop
+
+static void zswap_init(struct compression ** c_p)
+{
+    struct shared * sh = LAYOUT_NODE_NAME.sharedv;
+    struct compression * p;
+    char * v, * list = shared_config(sh, "zswap.list");
+    list = list != NULL ? list : "lz4,deflate";
+    zswap_fn = shared_config(sh, "zswap.trace");
+    zswap_n = 0;
+    for (p = *c_p; p != NULL && zswap_n < ZSWAP_MAX; p = p->next)
+    {
+        char * s = strstr(list, p->name);
+        size_t len = strlen(p->name);
+        //whole names only
+        while (s != NULL && ((s != list && s[-1] != ',') || (s[len] != ',' && s[len] != '\0')))
+            s = strstr(s + 1, p->name);
+        if (s != NULL)
+            zswap_pool[zswap_n++].c_p = p;
+    }
+    uint64_t memory = (v = shared_config(sh, "zswap.memory")) != NULL ? strtoull(v, NULL, 0) : sh->totalpages * PAGE_SIZE;
+    zswap_limit = memory * ((v = shared_config(sh, "zswap.max_pool_percent")) != NULL ? strtol(v, NULL, 0) : 20) / 100;
+    zswap_accept = zswap_limit * ((v = shared_config(sh, "zswap.accept_threshold")) != NULL ? strtol(v, NULL, 0) : 90) / 100;
+    zswap_same = zswap_n ? calloc(sh->totalpages / 8 + 1, 1) : NULL;
+}
+
+static void zswap_pr(struct compression * c_p, uint16_t * cl_list, uint16_t page_size, struct page_features * f)
+{
+    if (zswap_n && c_p == zswap_pool[0].c_p && f->same_filled)
+        __atomic_or_fetch(&zswap_same[f->index / 8], 1 << (f->index % 8), __ATOMIC_RELAXED);
+}
+
+static void zswap_unlink(struct zswap_pool * z, uint32_t p)
+{
+    if (z->prev[p] != NONE)
+        z->next[z->prev[p]] = z->next[p];
+    else
+        z->head = z->next[p];
+    if (z->next[p] != NONE)
+        z->prev[z->next[p]] = z->prev[p];
+    else
+        z->tail = z->prev[p];
+}
+
+static void zswap_push(struct zswap_pool * z, uint32_t p)
+{
+    z->prev[p] = NONE;
+    z->next[p] = z->head;
+    if (z->head != NONE)
+        z->prev[z->head] = p;
+    else
+        z->tail = p;
+    z->head = p;
+}
+
+static inline uint64_t zswap_bytes(struct zswap_pool * z, uint32_t p)
+{
+    return (z->c_p->page_report[p] + 7) / 8;
+}
+
+static void zswap_access(struct zswap_pool * z, uint32_t p)
+{
+    uint16_t size = z->c_p->page_report[p];
+    z->count[ZW_ACCESS]++;
+    if (z->state[p] == ZS_POOL)
+    {
+        z->count[ZW_HIT]++;
+        zswap_unlink(z, p);
+        zswap_push(z, p);
+        return;
+    }
+    if (z->state[p] == ZS_SAME)
+    {
+        z->count[ZW_HIT]++;
+        return;
+    }
+    z->count[z->state[p] == ZS_SWAP ? ZW_SWAPIN : ZW_COLD]++;
+    if (size == ZERO_SIZE || (zswap_same[p / 8] >> (p % 8) & 1))
+    {
+        z->state[p] = ZS_SAME;
+        return;
+    }
+    if (size >= PAGE_SIZE * 8)
+    {
+        z->count[ZW_REJECT]++;
+        z->state[p] = ZS_SWAP;
+        return;
+    }
+    uint64_t bytes = (size + 7) / 8;
+    if (z->bytes + bytes > zswap_limit)
+        while (z->tail != NONE && z->bytes + bytes > zswap_accept)
+        {
+            uint32_t victim = z->tail;
+            zswap_unlink(z, victim);
+            z->bytes -= zswap_bytes(z, victim);
+            z->state[victim] = ZS_SWAP;
+            z->count[ZW_WRITEBACK]++;
+        }
+    if (z->bytes + bytes > zswap_limit)
+    {
+        z->count[ZW_REJECT]++;
+        z->state[p] = ZS_SWAP;
+        return;
+    }
+    z->bytes += bytes;
+    z->state[p] = ZS_POOL;
+    zswap_push(z, p);
+}
+
+//replays block of pools begin to end
+static void zswap_replay(void * arg, uint64_t begin, uint64_t end, int chunk)
+{
+    uint64_t j;
+    int i;
+    for (j = begin; j < end; j++)
+    {
+        struct zswap_pool * z = &zswap_pool[j];
+        for (i = 0; i < z->block_count; i++)
+            zswap_access(z, z->block[i]);
+    }
+}
+
+//replays one block of accesses for every compression
+static void zswap_block(int64_t * block, int count)
+{
+    int j;
+    for (j = 0; j < zswap_n; j++)
+    {
+        zswap_pool[j].block = block;
+        zswap_pool[j].block_count = count;
+    }
+    LAYOUT_NODE_NAME.sharedv->parallel_for(zswap_n, zswap_replay, NULL);
+}
+
+static void zswap_fr(struct compression * c_p, uint64_t totalpages)
+{
+    int j, count = 0;
+    uint64_t unmapped = 0;
+    if (zswap_n == 0 || totalpages == 0 || totalpages >= NONE)
+    {
+        zswap_n = 0;
+        return;
+    }
+    FILE * tf = NULL;
+    if (zswap_fn != NULL && (tf = fopen(zswap_fn, "r")) == NULL)
+    {
+        printf("zswap: cannot open %s\n", zswap_fn);
+        zswap_n = 0;
+        return;
+    }
+    zswap_pages = totalpages;
+    for (j = 0; j < zswap_n; j++)
+    {
+        struct zswap_pool * z = &zswap_pool[j];
+        z->prev = malloc(sizeof(uint32_t) * totalpages);
+        z->next = malloc(sizeof(uint32_t) * totalpages);
+        z->state = calloc(totalpages, sizeof(uint8_t));
+        z->head = z->tail = NONE;
+        z->bytes = 0;
+        memset(z->count, 0, sizeof(z->count));
+    }
+    int64_t * block = malloc(sizeof(int64_t) * ZSWAP_BLOCK);
+    if (tf == NULL)
+    {
+        uint64_t p;
+        for (p = 0; p < totalpages; p++)
+        {
+            block[count++] = p;
+            if (count == ZSWAP_BLOCK)
+            {
+                zswap_block(block, count);
+                count = 0;
+            }
+        }
+    }
+    else
+    {
+        struct dump_segment * seg;
+        int segs = dump_segments(LAYOUT_NODE_NAME.sharedv->filename, &seg);
+        char line[256];
+        while (fgets(line, sizeof(line), tf) != NULL)
+        {
+            char * end;
+            uint64_t address = strtoull(line, &end, 16);
+            if (end == line)
+                continue;
+            int64_t page = segs ? dump_page(seg, segs, address) : (int64_t)(address / PAGE_SIZE);
+            if (page < 0 || page >= totalpages)
+            {
+                unmapped++;
+                continue;
+            }
+            block[count++] = page;
+            if (count == ZSWAP_BLOCK)
+            {
+                zswap_block(block, count);
+                count = 0;
+            }
+        }
+        fclose(tf);
+        free(seg);
+        if (unmapped)
+            printf("zswap: %"PRIu64" accesses outside the dump\n", unmapped);
+    }
+    if (count)
+        zswap_block(block, count);
+    free(block);
+}
+
+static void zswap_tcr()
+{   return;}
+
+//memory saved is of pages in the pool and same-filled pages in the end, against the dump
+static void zswap_cr()
+{
+    int j;
+    uint64_t p;
+    if (zswap_n == 0)
+        return;
+    printf("zswap(hit rate:writebacks:rejected:swap-ins:memory saved):limit=%"PRIu64":", zswap_limit);
+    for (j = 0; j < zswap_n; j++)
+    {
+        struct zswap_pool * z = &zswap_pool[j];
+        uint64_t resident = 0;
+        for (p = 0; p < zswap_pages; p++)
+            resident += z->state[p] == ZS_POOL || z->state[p] == ZS_SAME;
+        printf("%s=%lf:%"PRIu64":%"PRIu64":%"PRIu64":%lf:", z->c_p->name,
+            z->count[ZW_ACCESS] ? z->count[ZW_HIT] / (double)z->count[ZW_ACCESS] : 0, z->count[ZW_WRITEBACK],
+            z->count[ZW_REJECT], z->count[ZW_SWAPIN], (resident * PAGE_SIZE - z->bytes) / (double)(zswap_pages * PAGE_SIZE));
+        free(z->prev);
+        free(z->next);
+        free(z->state);
+    }
+    printf("\n");
+    free(zswap_same);
+}
+
+struct layout LAYOUT_NODE_NAME = {
+    .next = NULL,
+    .name = "zswap",
+    .L_init = (layout_init_t) zswap_init,
+    .L_page_r = (layout_page_report_t) zswap_pr,
+    .L_final_r = (layout_final_report_t) zswap_fr,
+    .L_thread_clean_r = (layout_thread_clean_t) zswap_tcr,
+    .L_clean_r = (layout_clean_t) zswap_cr,
+    .reports = NULL,
+    .report_count = 0,
+    .priority = -20,
+    .final_independent = 1
+};